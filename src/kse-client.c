@@ -0,0 +1,328 @@
+// load generator and example client for kse-server
+// sends -n short (interactive) speak requests spread over -c connections,
+// all at once or -r per second, reads the pcm streams back and reports time
+// to first audio, completion time and throughput per class. -l adds long
+// (bulk) requests of -L text sent first, to see how short prompts fare
+// behind them. -k cancels every k-th request as soon as its first audio
+// arrives, -f picks the reply format (f32, s16, s16d dithered, ulaw), -o
+// writes the first request's samples as they arrive in that format (a wav
+// file if the name ends in .wav, raw otherwise), -S prints the server stats
+// afterwards. -R reads at playback speed: every request plays its audio in
+// real time from its first block, and a connection is read only while one
+// of its requests holds less than the given seconds of audio, so the server
+// sees clients that keep up but get no further ahead
+//
+//   cc -O2 src/kse-client.c -lm -o kse-client
+//   ./kse-client -s /tmp/kse.sock -n 400 -c 50 "Hello there."
+//   ./kse-client -s /tmp/kse.sock -l 4 -n 200 -r 20 -S
+//   ./kse-client -s /tmp/kse.sock -l 2 -L "A short story." -n 50 -r 5 -R 0.2
+#include "kse_proto.h"
+#include "tts_wav.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+typedef struct {
+	double   sent, first, end;   // seconds since start, 0 until it happens
+	double   play_end;           // -R: when what arrived so far has played out
+	uint32_t status, samples;
+	int      conn, cls;
+} Req;
+
+typedef struct {
+	int      fd;
+	uint8_t *in;
+	int      in_len, in_cap;
+} Conn;
+
+static double now_sec(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+static int connect_unix(const char *path)
+{
+	struct sockaddr_un a;
+	memset(&a, 0, sizeof(a));
+	a.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(a.sun_path)) return -1;
+	strcpy(a.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, (struct sockaddr *)&a, sizeof(a)) < 0) { close(fd); return -1; }
+	return fd;
+}
+
+static int send_all(int fd, const uint8_t *p, int len)
+{
+	while (len > 0) {
+		ssize_t n = send(fd, p, (size_t)len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return 0;
+		p += n; len -= (int)n;
+	}
+	return 1;
+}
+
+static int send_speak(int fd, uint32_t id, const char *text, int cls, int fmt, float speed, float pitch, uint32_t seed)
+{
+	int tlen = (int)strlen(text), plen = KSE_SPEAK_HDR + tlen;
+	uint8_t *m = (uint8_t *)calloc(1, (size_t)(5 + plen));
+	if (!m) return 0;
+	kse_header(m, KSE_SPEAK, (uint32_t)plen);
+	kse_put32(m + 5, id);
+	kse_putf(m + 9, speed);
+	kse_putf(m + 13, pitch);
+	m[17] = 2;   // auto language
+	m[19] = (uint8_t)cls;
+	m[20] = (uint8_t)fmt;
+	kse_put32(m + 21, seed);
+	memcpy(m + 5 + KSE_SPEAK_HDR, text, (size_t)tlen);
+	int ok = send_all(fd, m, 5 + plen);
+	free(m);
+	return ok;
+}
+
+static int send_small(int fd, uint8_t type, uint32_t id, int with_id)
+{
+	uint8_t m[9];
+	kse_header(m, type, with_id ? 4 : 0);
+	kse_put32(m + 5, id);
+	return send_all(fd, m, with_id ? 9 : 5);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static double pct(double *v, int n, double p)
+{
+	if (n <= 0) return 0.0;
+	int i = (int)(p * (n - 1) + 0.5);
+	return v[i];
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = "/tmp/kse.sock", *out = NULL;
+	const char *text = "The quick brown fox jumps over the lazy dog.";
+	const char *para = "The harbour was quiet when the first boats came back, their engines coughing "
+	                   "in the cold morning air. Nobody on the pier said much. The catch had been poor "
+	                   "for three weeks now, and everyone knew what that meant for the winter. ";
+	const char *long_text = NULL;
+	int n = 100, nc = 10, every = 0, stats = 0, nlong = 0, fmt = KSE_FMT_F32;
+	double rate = 0.0, ahead = 0.0;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-s") && i + 1 < argc) path = argv[++i];
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc) n = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-c") && i + 1 < argc) nc = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-k") && i + 1 < argc) every = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-o") && i + 1 < argc) out = argv[++i];
+		else if (!strcmp(argv[i], "-l") && i + 1 < argc) nlong = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-L") && i + 1 < argc) long_text = argv[++i];
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc) rate = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-R") && i + 1 < argc) ahead = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+			const char *f = argv[++i];
+			fmt = !strcmp(f, "s16") ? KSE_FMT_S16 : !strcmp(f, "s16d") ? (KSE_FMT_S16 | KSE_FMT_DITHER) :
+			      !strcmp(f, "ulaw") ? KSE_FMT_ULAW : KSE_FMT_F32;
+		}
+		else if (!strcmp(argv[i], "-S")) stats = 1;
+		else if (argv[i][0] != '-') text = argv[i];
+		else {
+			fprintf(stderr, "usage: %s [-s socket] [-n requests] [-c connections] [-r per_second] "
+			        "[-l long_requests] [-L long_text] [-k cancel_every] [-f f32|s16|s16d|ulaw] [-o out.pcm|out.wav] [-R ahead_s] [-S] [text]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (n < 0) n = 0;
+	if (nlong < 0) nlong = 0;
+	if (nc < 1) nc = 1;
+	if (nc > n + nlong && n + nlong > 0) nc = n + nlong;
+
+	// default long text: the paragraph a few times over, a few minutes of audio
+	char *made = NULL;
+	if (nlong && !long_text) {
+		size_t pl = strlen(para);
+		made = (char *)malloc(pl * 12 + 1);
+		if (!made) return 1;
+		for (int i = 0; i < 12; i++) memcpy(made + pl * (size_t)i, para, pl);
+		made[pl * 12] = '\0';
+		long_text = made;
+	}
+	int total = n + nlong;   // ids 0 .. nlong-1 are the long ones
+
+	Conn *conns = (Conn *)calloc((size_t)nc, sizeof(Conn));
+	Req  *reqs  = (Req *)calloc((size_t)(total > 0 ? total : 1), sizeof(Req));
+	struct pollfd *pfd = (struct pollfd *)calloc((size_t)nc, sizeof(struct pollfd));
+	if (!conns || !reqs || !pfd) return 1;
+	for (int c = 0; c < nc; c++) {
+		conns[c].fd = connect_unix(path);
+		if (conns[c].fd < 0) { perror(path); return 1; }
+		pfd[c].fd = conns[c].fd;
+		pfd[c].events = POLLIN;
+	}
+	FILE *fo = NULL;
+	WavFile *wo = NULL;
+	size_t ol = out ? strlen(out) : 0;
+	if (ol > 4 && !strcmp(out + ol - 4, ".wav")) {
+		// wav formats number like the protocol's
+		wo = (WavFile *)malloc(sizeof(WavFile));
+		if (!wo || !wav_open(wo, out, fmt & ~KSE_FMT_DITHER, KSE_SAMPLE_RATE)) { perror(out); return 1; }
+	} else if (out && !(fo = fopen(out, "wb"))) {
+		perror(out);
+		return 1;
+	}
+
+	double t0 = now_sec();
+	int next = 0, left = total;
+	uint64_t samples = 0;
+	while (left > 0) {
+		// send what is due: long requests and unpaced short ones at once
+		double t = now_sec() - t0;
+		while (next < total && (next < nlong || rate <= 0.0 || t >= (next - nlong) / rate)) {
+			int c = next % nc, lng = next < nlong;
+			reqs[next].conn = c;
+			reqs[next].cls  = lng ? KSE_BULK : KSE_INTERACTIVE;
+			reqs[next].sent = now_sec() - t0;
+			if (!send_speak(conns[c].fd, (uint32_t)next, lng ? long_text : text, reqs[next].cls, fmt,
+			                1.0f, 120.0f, (uint32_t)next + 1)) { perror("send"); return 1; }
+			next++;
+		}
+		int wait = 10000, playing = 0;
+		if (next < total) wait = (int)(((next - nlong) / rate - (now_sec() - t0)) * 1e3) + 1;
+		// -R: a connection whose requests all hold enough audio is not read
+		// until one of them has played down
+		t = now_sec() - t0;
+		for (int c = 0; c < nc && ahead > 0.0; c++) {
+			double full = 0.0;
+			int live = 0;
+			for (int i = c; i < next; i += nc) {
+				if (reqs[i].end != 0.0) continue;
+				double f = reqs[i].play_end - ahead - t;
+				if (!live++ || f < full) full = f;
+			}
+			pfd[c].events = live && full > 0.0 ? 0 : POLLIN;
+			if (live && full > 0.0) {
+				playing = 1;
+				if (full * 1e3 + 1 < wait) wait = (int)(full * 1e3) + 1;
+			}
+		}
+		if (wait < 0) wait = 0;
+		int ready = poll(pfd, (nfds_t)nc, wait);
+		if (ready < 0 || (ready == 0 && next == total && !playing)) { fprintf(stderr, "timed out, %d requests left\n", left); break; }
+		for (int c = 0; c < nc; c++) {
+			if (!(pfd[c].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+			Conn *k = &conns[c];
+			if (k->in_cap - k->in_len < 65536) {
+				int cap = k->in_cap ? k->in_cap * 2 : 1 << 17;
+				uint8_t *nb = (uint8_t *)realloc(k->in, (size_t)cap);
+				if (!nb) return 1;
+				k->in = nb; k->in_cap = cap;
+			}
+			// a real time reader takes a few blocks at a time
+			size_t room = (size_t)(k->in_cap - k->in_len);
+			if (ahead > 0.0 && room > 16384) room = 16384;
+			ssize_t got = recv(k->fd, k->in + k->in_len, room, 0);
+			if (got <= 0) { fprintf(stderr, "connection %d closed\n", c); return 1; }
+			k->in_len += (int)got;
+
+			int off = 0;
+			while (k->in_len - off >= 5) {
+				uint32_t mlen = kse_get32(k->in + off);
+				if ((uint32_t)(k->in_len - off - 4) < mlen) break;
+				const uint8_t *m = k->in + off + 4;
+				uint32_t id = mlen >= 5 ? kse_get32(m + 1) : 0;
+				Req *r = id < (uint32_t)total ? &reqs[id] : NULL;
+				if (r && m[0] == KSE_PCM) {
+					int cnt = (int)(mlen - 5) / kse_fmt_bytes(fmt);
+					if (r->first == 0.0) {
+						r->first = now_sec() - t0;
+						if (every > 0 && id % (uint32_t)every == (uint32_t)every - 1)
+							send_small(k->fd, KSE_CANCEL, id, 1);
+					}
+					r->samples += (uint32_t)cnt;
+					samples    += (uint64_t)cnt;
+					double at = now_sec() - t0;
+					if (r->play_end < at) r->play_end = at;
+					r->play_end += (double)cnt / KSE_SAMPLE_RATE;
+					if (fo && id == 0) fwrite(m + 5, 1, mlen - 5, fo);
+					if (wo && id == 0) wav_write_raw(wo, m + 5, (int)mlen - 5);
+				} else if (r && m[0] == KSE_END) {
+					r->end    = now_sec() - t0;
+					r->status = kse_get32(m + 5);
+					left--;
+				}
+				off += 4 + (int)mlen;
+			}
+			memmove(k->in, k->in + off, (size_t)(k->in_len - off));
+			k->in_len -= off;
+		}
+	}
+	double wall = now_sec() - t0;
+	if (fo) fclose(fo);
+	if (wo && !wav_close(wo)) perror(out);
+	free(wo);
+
+	// latencies per class over requests that completed normally
+	double *ttfa = (double *)malloc(sizeof(double) * (size_t)(total > 0 ? total : 1));
+	double *done = (double *)malloc(sizeof(double) * (size_t)(total > 0 ? total : 1));
+	printf("wall %.3f s, audio %.1f s, %.1fx realtime\n",
+	       wall, (double)samples / KSE_SAMPLE_RATE, (double)samples / KSE_SAMPLE_RATE / wall);
+	for (int cls = KSE_INTERACTIVE; cls <= KSE_BULK; cls++) {
+		int ok = 0, cancelled = 0, busy = 0, failed = 0, all = 0;
+		for (int i = 0; i < total; i++) {
+			Req *r = &reqs[i];
+			if (r->cls != cls) continue;
+			all++;
+			if (r->end == 0.0) continue;
+			if (r->status == KSE_OK) {
+				ttfa[ok] = r->first - r->sent;
+				done[ok] = r->end - r->sent;
+				ok++;
+			} else if (r->status == KSE_CANCELLED) cancelled++;
+			else if (r->status == KSE_BUSY) busy++;
+			else failed++;
+		}
+		if (!all) continue;
+		qsort(ttfa, (size_t)ok, sizeof(double), cmp_double);
+		qsort(done, (size_t)ok, sizeof(double), cmp_double);
+		printf("%s: %d requests over %d connections: ok %d cancelled %d busy %d failed %d, %.1f/s\n",
+		       cls == KSE_BULK ? "bulk" : "interactive", all, nc, ok, cancelled, busy, failed, ok / wall);
+		printf("  first audio ms  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+		       pct(ttfa, ok, 0.5) * 1e3, pct(ttfa, ok, 0.9) * 1e3, pct(ttfa, ok, 0.99) * 1e3, pct(ttfa, ok, 1.0) * 1e3);
+		printf("  complete ms     p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+		       pct(done, ok, 0.5) * 1e3, pct(done, ok, 0.9) * 1e3, pct(done, ok, 0.99) * 1e3, pct(done, ok, 1.0) * 1e3);
+	}
+
+	if (stats) {
+		send_small(conns[0].fd, KSE_STATS, 0, 0);
+		Conn *k = &conns[0];
+		for (;;) {
+			if (k->in_len >= 5 && (uint32_t)(k->in_len - 4) >= kse_get32(k->in)) break;
+			if (k->in_cap - k->in_len < 4096) {
+				uint8_t *nb = (uint8_t *)realloc(k->in, (size_t)(k->in_cap + 65536));
+				if (!nb) return 1;
+				k->in = nb; k->in_cap += 65536;
+			}
+			ssize_t got = recv(k->fd, k->in + k->in_len, (size_t)(k->in_cap - k->in_len), 0);
+			if (got <= 0) return 1;
+			k->in_len += (int)got;
+		}
+		if (k->in[4] == KSE_STATSR) fwrite(k->in + 5, 1, kse_get32(k->in) - 1, stdout);
+	}
+	for (int c = 0; c < nc; c++) close(conns[c].fd);
+	free(made);
+	return 0;
+}
@@ -0,0 +1,751 @@
+// native synthesis daemon on a unix domain socket
+// one thread accepts connections and reads requests, a fixed pool of
+// workers each owns an engine context and streams pcm back as it renders.
+// replies go through a per-connection outbox; what the socket does not take
+// at once the io thread sends on POLLOUT, so it never waits on a client.
+// nor does a worker: a request whose client has not taken its last block is
+// parked on the connection and requeued once the outbox has drained.
+// protocol in kse_proto.h, load generator in kse-client.c
+//
+// requests are rendered in quanta of a few blocks and rescheduled in
+// between, earliest deadline first. a request's first deadline is its
+// arrival plus the first audio target of its class; once audio flows it is
+// the moment the client, playing in real time, would get down to
+// KSE_CUSHION seconds of buffered audio. a long render that is ahead of
+// real time therefore yields to short prompts at the next quantum, and
+// catches up on its own before its listener could hear a gap
+//
+// with -C seeded requests go through the on-disk pcm cache of tts-web.c:
+// a hit is sent straight from the mapped entry, a miss keeps what it sends
+// and stores it once the request completes
+//
+// -T renders a test corpus through every simd path the cpu runs, checks it
+// against the reference kernels (tts_conformance) and exits 1 on a miss.
+// -B times rendering of dense and of pause-heavy text (tts_bench)
+//
+//   cc -O2 -pthread src/kse-server.c -lm -o kse-server
+//   ./kse-server -s /tmp/kse.sock -w 4 -C /var/cache/kse -M 2048
+#include "tts-web.c"
+#include "kse_proto.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define KSE_MAX_CONNS  1024
+#define KSE_QUEUE      1024   // requests queued, running or parked, more are refused
+#define KSE_BLOCK      1024   // samples per pcm message
+#define KSE_OUT_MAX    (1 << 20)   // unsent bytes a client may pile up before it is dropped
+#define KSE_QUANTUM    4      // blocks rendered before a request is rescheduled
+#define KSE_CUSHION    1.0    // seconds of audio a playing client should hold
+#define KSE_SHORT_TEXT 256    // auto class: texts up to this many bytes are interactive
+#define KSE_HIST       80     // latency buckets, 2^(1/4) apart from 0.1 ms
+
+// first audio targets per class, seconds
+static const double kse_target[KSE_CLASSES] = { 0.0, 0.05, 1.0 };
+static const char  *kse_class_name[KSE_CLASSES] = { "", "interactive", "bulk" };
+
+typedef struct Conn {
+	int             fd;
+	int             refs;     // io thread plus live requests, under srv.lock
+	int             closed;   // peer gone or dropped, its requests stop
+	pthread_mutex_t wlock;    // the outbox, never held across a wait
+	uint8_t        *out;      // whole messages the socket has not taken yet
+	int             out_len, out_cap;
+	struct Request *parked;   // waiting for the outbox to drain, under wlock
+	uint8_t        *in;       // partial messages, io thread only
+	int             in_len, in_cap;
+} Conn;
+
+typedef struct Request {
+	Conn           *conn;
+	uint32_t        id;
+	float           speed, pitch;
+	int             lang, whisper;
+	OutFmt          fmt;          // wire format of the pcm replies
+	uint32_t        seed;
+	char           *text;
+	int             cancel;
+	int             cls;          // KSE_INTERACTIVE or KSE_BULK
+	double          queued_at;
+	double          first_at;     // first audio sent, 0 before
+	double          deadline;     // scheduling key
+	uint64_t        order;        // arrival order, breaks deadline ties
+	uint32_t        sent;         // samples sent so far
+	TTSSeq         *seq;          // render state, made on the first quantum
+	TTSStream      *st;
+	char           *key;          // cache key, NULL when not cached
+	int             klen;
+	const float    *hit;          // mapped cache entry, sent instead of rendering
+	int             hit_len;
+	float          *rec;          // samples sent so far, stored on completion
+	int             rec_cap;
+	struct Request *next;         // live list, under srv.lock
+	struct Request *park_next;    // parked on the same connection
+} Request;
+
+// latency histogram
+typedef struct {
+	uint64_t n;
+	double   sum, max;
+	uint32_t b[KSE_HIST];
+} Hist;
+
+typedef struct {
+	uint64_t requests, done, cancelled, failed, busy;
+	uint64_t samples;
+	double   render_sum;          // seconds workers spent on requests
+	uint64_t conns_total;
+	Hist     wait[KSE_CLASSES];   // arrival to first quantum
+	Hist     first[KSE_CLASSES];  // arrival to first audio sent
+} KseStats;
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t  more;
+	Request        *heap[KSE_QUEUE];   // runnable requests, earliest deadline on top
+	int             q_count;
+	uint64_t        order;
+	Request        *live;
+	int             active, parked, conns, workers;
+	int             quantum;           // blocks per turn, INT_MAX runs requests to the end
+	int             cache;             // tts_cache_open succeeded
+	int             stop;
+	int             wake[2];           // pipe that gets the io thread out of poll
+	KseStats        st;
+	double          started;
+} srv = { .lock = PTHREAD_MUTEX_INITIALIZER, .more = PTHREAD_COND_INITIALIZER };
+
+static TTSContext kse_ctx[TTS_MAX_WORKERS];
+static volatile sig_atomic_t kse_quit = 0;
+
+static double now_sec(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+static void hist_add(Hist *h, double sec)
+{
+	double ms = sec * 1e3;
+	int k = ms <= 0.1 ? 0 : (int)(4.0 * log2(ms / 0.1)) + 1;
+	if (k >= KSE_HIST) k = KSE_HIST - 1;
+	h->b[k]++;
+	h->n++;
+	h->sum += ms;
+	if (ms > h->max) h->max = ms;
+}
+
+// upper edge of the bucket holding the p quantile, ms
+static double hist_pct(const Hist *h, double p)
+{
+	if (!h->n) return 0.0;
+	uint64_t want = (uint64_t)ceil(p * (double)h->n), acc = 0;
+	for (int k = 0; k < KSE_HIST; k++) {
+		acc += h->b[k];
+		if (acc >= want) {
+			double edge = 0.1 * pow(2.0, k / 4.0);
+			return edge < h->max ? edge : h->max;
+		}
+	}
+	return h->max;
+}
+
+// binary heap on (deadline, order), under srv.lock
+static int req_before(const Request *a, const Request *b)
+{
+	return a->deadline < b->deadline || (a->deadline == b->deadline && a->order < b->order);
+}
+
+static void heap_push(Request *r)
+{
+	int i = srv.q_count++;
+	while (i > 0) {
+		int up = (i - 1) / 2;
+		if (!req_before(r, srv.heap[up])) break;
+		srv.heap[i] = srv.heap[up];
+		i = up;
+	}
+	srv.heap[i] = r;
+}
+
+static Request *heap_pop(void)
+{
+	Request *top = srv.heap[0], *last = srv.heap[--srv.q_count];
+	int i = 0;
+	for (;;) {
+		int c = 2 * i + 1;
+		if (c >= srv.q_count) break;
+		if (c + 1 < srv.q_count && req_before(srv.heap[c + 1], srv.heap[c])) c++;
+		if (!req_before(srv.heap[c], last)) break;
+		srv.heap[i] = srv.heap[c];
+		i = c;
+	}
+	if (srv.q_count) srv.heap[i] = last;
+	return top;
+}
+
+static void conn_unref(Conn *c)
+{
+	pthread_mutex_lock(&srv.lock);
+	int last = --c->refs == 0;
+	if (last) srv.conns--;
+	pthread_mutex_unlock(&srv.lock);
+	if (!last) return;
+	close(c->fd);
+	pthread_mutex_destroy(&c->wlock);
+	free(c->out);
+	free(c->in);
+	free(c);
+}
+
+static int req_stopped(Request *r)
+{
+	return __atomic_load_n(&r->cancel, __ATOMIC_ACQUIRE) || __atomic_load_n(&r->conn->closed, __ATOMIC_ACQUIRE);
+}
+
+// send what the outbox holds as far as the socket takes it, wlock held
+static int out_flush(Conn *c)
+{
+	int done = 0;
+	while (done < c->out_len) {
+		ssize_t n = send(c->fd, c->out + done, (size_t)(c->out_len - done), MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n > 0) { done += (int)n; continue; }
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+		__atomic_store_n(&c->closed, 1, __ATOMIC_RELEASE);
+		break;
+	}
+	memmove(c->out, c->out + done, (size_t)(c->out_len - done));
+	__atomic_store_n(&c->out_len, c->out_len - done, __ATOMIC_RELEASE);
+	return !__atomic_load_n(&c->closed, __ATOMIC_ACQUIRE);
+}
+
+// queue a whole message behind what the connection still holds and send
+// what the socket takes now. nothing here waits, so the io thread can reply
+// while a worker's client is stalled; it sends the rest on POLLOUT. a client
+// that lets KSE_OUT_MAX bytes pile up unread is dropped
+static int conn_send(Conn *c, const uint8_t *buf, int len)
+{
+	pthread_mutex_lock(&c->wlock);
+	int ok = !__atomic_load_n(&c->closed, __ATOMIC_ACQUIRE) && c->out_len + len <= KSE_OUT_MAX;
+	if (ok && c->out_len + len > c->out_cap) {
+		int cap = c->out_cap ? c->out_cap : 16384;
+		while (cap < c->out_len + len) cap *= 2;
+		uint8_t *nb = (uint8_t *)realloc(c->out, (size_t)cap);
+		if (nb) { c->out = nb; c->out_cap = cap; }
+		ok = nb != NULL;
+	}
+	if (ok) {
+		memcpy(c->out + c->out_len, buf, (size_t)len);
+		__atomic_store_n(&c->out_len, c->out_len + len, __ATOMIC_RELEASE);
+		ok = out_flush(c);
+	} else __atomic_store_n(&c->closed, 1, __ATOMIC_RELEASE);
+	int left = c->out_len;
+	pthread_mutex_unlock(&c->wlock);
+	// the io thread picks up the rest, or the drop
+	if (!ok || left) { ssize_t w = write(srv.wake[1], "", 1); (void)w; }
+	return ok;
+}
+
+// backpressure: park a request whose client has not taken what was sent
+// before, under srv.lock. 0 when the outbox drained meanwhile or the request
+// has to stop, it is then requeued as usual
+static int conn_park(Request *r)
+{
+	Conn *c = r->conn;
+	pthread_mutex_lock(&c->wlock);
+	int park = c->out_len && !req_stopped(r);
+	if (park) {
+		r->park_next = c->parked;
+		c->parked = r;
+	}
+	pthread_mutex_unlock(&c->wlock);
+	return park;
+}
+
+static void req_requeue(Request *r)
+{
+	if (!r) return;
+	pthread_mutex_lock(&srv.lock);
+	for (Request *nx; r; r = nx) {
+		nx = r->park_next;
+		srv.parked--;
+		heap_push(r);
+	}
+	pthread_cond_broadcast(&srv.more);
+	pthread_mutex_unlock(&srv.lock);
+}
+
+// requeue everything parked on a connection, so a cancel or drop is seen
+static void conn_wake(Conn *c)
+{
+	pthread_mutex_lock(&c->wlock);
+	Request *r = c->parked;
+	c->parked = NULL;
+	pthread_mutex_unlock(&c->wlock);
+	req_requeue(r);
+}
+
+// io thread on POLLOUT, requeues the parked requests once all is sent
+static int conn_flush(Conn *c)
+{
+	pthread_mutex_lock(&c->wlock);
+	int ok = out_flush(c);
+	Request *r = NULL;
+	if (!c->out_len) { r = c->parked; c->parked = NULL; }
+	pthread_mutex_unlock(&c->wlock);
+	req_requeue(r);
+	return ok;
+}
+
+static void send_end(Conn *c, uint32_t id, uint32_t status, uint32_t samples)
+{
+	uint8_t m[17];
+	kse_header(m, KSE_END, 12);
+	kse_put32(m + 5, id);
+	kse_put32(m + 9, status);
+	kse_put32(m + 13, samples);
+	conn_send(c, m, sizeof(m));
+}
+
+static void send_stats(Conn *c)
+{
+	char txt[2048];
+	pthread_mutex_lock(&srv.lock);
+	KseStats st = srv.st;
+	int queued = srv.q_count, active = srv.active, parked = srv.parked, conns = srv.conns;
+	pthread_mutex_unlock(&srv.lock);
+	int n = snprintf(txt, sizeof(txt),
+		"uptime_s %.1f\nworkers %d\nscheduler %s\nkernels %s\nconnections %d\nconnections_total %llu\n"
+		"requests %llu\nqueued %d\nactive %d\nparked %d\ndone %llu\ncancelled %llu\nfailed %llu\nbusy %llu\n"
+		"samples %llu\naudio_s %.1f\nrender_s %.3f\n",
+		now_sec() - srv.started, srv.workers, srv.quantum == INT_MAX ? "fifo" : "edf",
+		tts_kernels.name, conns, (unsigned long long)st.conns_total,
+		(unsigned long long)st.requests, queued, active, parked, (unsigned long long)st.done,
+		(unsigned long long)st.cancelled, (unsigned long long)st.failed, (unsigned long long)st.busy,
+		(unsigned long long)st.samples, (double)st.samples / KSE_SAMPLE_RATE, st.render_sum);
+	for (int k = 1; k < KSE_CLASSES && n < (int)sizeof(txt); k++) {
+		const Hist *w = &st.wait[k], *f = &st.first[k];
+		n += snprintf(txt + n, sizeof(txt) - (size_t)n,
+			"%s_requests %llu\n%s_wait_avg_ms %.3f\n%s_wait_p99_ms %.3f\n"
+			"%s_first_audio_p50_ms %.3f\n%s_first_audio_p99_ms %.3f\n%s_first_audio_max_ms %.3f\n",
+			kse_class_name[k], (unsigned long long)w->n,
+			kse_class_name[k], w->n ? w->sum / (double)w->n : 0.0, kse_class_name[k], hist_pct(w, 0.99),
+			kse_class_name[k], hist_pct(f, 0.5), kse_class_name[k], hist_pct(f, 0.99),
+			kse_class_name[k], f->max);
+	}
+	if (srv.cache && n < (int)sizeof(txt))
+		n += snprintf(txt + n, sizeof(txt) - (size_t)n, "cache_hits %llu\ncache_misses %llu\ncache_mb %.1f\n",
+			(unsigned long long)__atomic_load_n(&tts_cache.hits, __ATOMIC_RELAXED),
+			(unsigned long long)__atomic_load_n(&tts_cache.misses, __ATOMIC_RELAXED),
+			(double)__atomic_load_n(&tts_cache.bytes, __ATOMIC_RELAXED) / (1 << 20));
+	if (n >= (int)sizeof(txt)) n = (int)sizeof(txt) - 1;
+	uint8_t m[5 + sizeof(txt)];
+	kse_header(m, KSE_STATSR, (uint32_t)n);
+	memcpy(m + 5, txt, (size_t)n);
+	conn_send(c, m, 5 + n);
+}
+
+// apply the request voice to a worker context, ranges as the tts_set_* calls.
+// every per-request field is set, so nothing carries over from the request
+// the worker served before; seed 0 seeds from the clock on first use
+static void ctx_voice(TTSContext *ctx, const Request *r)
+{
+	double spd = r->speed, hz = r->pitch;
+	if (!(spd >= 0.1)) spd = spd > 0.0 ? 0.1 : 1.0;
+	if (spd > 8.0) spd = 8.0;
+	if (!(hz >= 50.0)) hz = hz > 0.0 ? 50.0 : 120.0;
+	if (hz > 300.0) hz = 300.0;
+	ctx->read_speed = spd;
+	ctx->base_f0    = hz;
+	ctx->lang       = r->lang == 0 ? LANG_RU : (r->lang == 1 ? LANG_EN : LANG_AUTO);
+	ctx->whisper    = r->whisper ? 1 : 0;
+	ctx->voice      = 0;
+	ctx->format     = TTS_FMT_F32;   // replies are packed from float by pack_pcm
+	ctx->dither     = 0;
+	ctx->seed       = r->seed;
+	ctx->rng        = 0;
+}
+
+// keep a copy of what a cached request sends, recording stops on failure
+static void req_record(Request *r, const float *pcm, int n)
+{
+	int need = (int)r->sent + n;
+	if (need > r->rec_cap) {
+		int cap = r->rec_cap ? r->rec_cap * 2 : r->st->total;
+		if (cap < need) cap = need;
+		float *nb = (float *)realloc(r->rec, (size_t)cap * sizeof(float));
+		if (!nb) { free(r->rec); r->rec = NULL; r->rec_cap = 0; free(r->key); r->key = NULL; return; }
+		r->rec = nb; r->rec_cap = cap;
+	}
+	memcpy(r->rec + r->sent, pcm, (size_t)n * sizeof(float));
+}
+
+// pcm payload in the request's wire format, returns its bytes
+static int pack_pcm(Request *r, const float *pcm, int n, uint8_t *out)
+{
+	if (r->fmt.format == TTS_FMT_ULAW) {
+		for (int i = 0; i < n; i++) fmt_store(&r->fmt, out, i, pcm[i]);
+		return n;
+	}
+	if (r->fmt.format == TTS_FMT_S16) {
+		for (int i = 0; i < n; i++) {
+			uint16_t v = (uint16_t)fmt_s16(&r->fmt, pcm[i]);   // little-endian on the wire
+			out[2 * i] = (uint8_t)v; out[2 * i + 1] = (uint8_t)(v >> 8);
+		}
+		return n * 2;
+	}
+	for (int i = 0; i < n; i++) kse_putf(out + i * 4, pcm[i]);
+	return n * 4;
+}
+
+#define KSE_MORE   0xFFFFFFFFu   // quantum used up, request goes back in the queue
+#define KSE_PARKED 0xFFFFFFFEu   // client behind, request waits on its connection
+
+// render one quantum of a request and send it, returns its status
+static uint32_t run_quantum(int w, Request *r)
+{
+	static __thread uint8_t msg[9 + KSE_BLOCK * 4];
+	static __thread float   pcm[KSE_BLOCK];
+	if (req_stopped(r)) return KSE_CANCELLED;
+
+	// the front end runs on this worker's context, rendering state stays
+	// with the request so a later quantum can run on any worker
+	if (!r->st) {
+		TTSContext *ctx = &kse_ctx[w];
+		r->st  = (TTSStream *)calloc(1, sizeof(TTSStream));
+		if (!r->st) return KSE_FAILED;
+		ctx_voice(ctx, r);
+		if (srv.cache && r->seed) {   // unseeded output is not reproducible, never cached
+			r->key = cache_key(ctx, TTS_CACHE_STREAM, r->text, &r->klen);
+			r->hit = cache_lookup(r->key, r->klen, &r->hit_len);
+		}
+		if (!r->hit) {
+			r->seq = seq_new(256);
+			if (!r->seq || stream_begin(ctx, r->st, r->seq, r->text) <= 0) return KSE_FAILED;
+		}
+	}
+	int more = 1;
+	for (int b = 0; b < srv.quantum && more; b++) {
+		if (__atomic_load_n(&r->conn->out_len, __ATOMIC_ACQUIRE)) return KSE_PARKED;
+		int got;
+		if (r->hit) {
+			got = r->hit_len - (int)r->sent < KSE_BLOCK ? r->hit_len - (int)r->sent : KSE_BLOCK;
+			memcpy(pcm, r->hit + r->sent, (size_t)got * sizeof(float));
+			more = (int)r->sent + got < r->hit_len;
+		} else {
+			got  = stream_read(r->st, pcm, KSE_BLOCK);
+			more = r->st->active;
+		}
+		if (got <= 0) break;
+		if (req_stopped(r)) return KSE_CANCELLED;
+		int bytes = pack_pcm(r, pcm, got, msg + 9);
+		kse_header(msg, KSE_PCM, 4 + (uint32_t)bytes);
+		kse_put32(msg + 5, r->id);
+		if (!conn_send(r->conn, msg, 9 + bytes)) return KSE_CANCELLED;
+		if (r->first_at == 0.0) r->first_at = now_sec();
+		if (r->key && !r->hit) req_record(r, pcm, got);
+		r->sent += (uint32_t)got;
+	}
+	if (more) return KSE_MORE;
+	if (r->rec) cache_store(r->key, r->klen, r->rec, (int)r->sent, KSE_SAMPLE_RATE);
+	return KSE_OK;
+}
+
+static void req_free(Request *r)
+{
+	pthread_mutex_lock(&srv.lock);
+	for (Request **p = &srv.live; *p; p = &(*p)->next)
+		if (*p == r) { *p = r->next; break; }
+	pthread_mutex_unlock(&srv.lock);
+	Conn *c = r->conn;
+	free_tts(r->seq);
+	if (r->st) stream_free(r->st);
+	free(r->st);
+	cache_release(r->hit);
+	free(r->rec);
+	free(r->key);
+	free(r->text);
+	free(r);
+	conn_unref(c);
+}
+
+static void *worker_main(void *arg)
+{
+	int w = (int)(intptr_t)arg;
+	kn_denormals_off();   // flush-to-zero for every render this thread runs
+	for (;;) {
+		pthread_mutex_lock(&srv.lock);
+		while (!srv.q_count && !srv.stop) pthread_cond_wait(&srv.more, &srv.lock);
+		// on shutdown the queue drains first, its requests are cancelled by then
+		if (!srv.q_count) { pthread_mutex_unlock(&srv.lock); break; }
+		Request *r = heap_pop();
+		srv.active++;
+		pthread_mutex_unlock(&srv.lock);
+
+		double t0 = now_sec();
+		int fresh = !r->st, silent = r->first_at == 0.0;
+		uint32_t status = run_quantum(w, r);
+		double t1 = now_sec();
+
+		pthread_mutex_lock(&srv.lock);
+		srv.active--;
+		srv.st.render_sum += t1 - t0;
+		if (fresh) hist_add(&srv.st.wait[r->cls], t0 - r->queued_at);
+		if (silent && r->first_at != 0.0) hist_add(&srv.st.first[r->cls], r->first_at - r->queued_at);
+		if (status == KSE_MORE || status == KSE_PARKED) {
+			// due when the listener would be down to the cushion
+			if (r->first_at != 0.0) r->deadline = r->first_at + (double)r->sent / KSE_SAMPLE_RATE - KSE_CUSHION;
+			if (srv.quantum == INT_MAX) r->deadline = r->queued_at;
+			if (status == KSE_PARKED && conn_park(r)) {
+				srv.parked++;
+				pthread_mutex_unlock(&srv.lock);
+				continue;
+			}
+			heap_push(r);
+			pthread_cond_signal(&srv.more);
+			pthread_mutex_unlock(&srv.lock);
+			continue;
+		}
+		if (status == KSE_OK) srv.st.done++;
+		else if (status == KSE_CANCELLED) srv.st.cancelled++;
+		else srv.st.failed++;
+		srv.st.samples += r->sent;
+		pthread_mutex_unlock(&srv.lock);
+		send_end(r->conn, r->id, status, r->sent);
+		req_free(r);
+	}
+	return NULL;
+}
+
+// queue a speak request, refused with KSE_BUSY when the queue is full
+static void on_speak(Conn *c, const uint8_t *p, int len)
+{
+	if (len < KSE_SPEAK_HDR) { __atomic_store_n(&c->closed, 1, __ATOMIC_RELEASE); return; }
+	uint32_t id = kse_get32(p);
+	Request *r = (Request *)calloc(1, sizeof(Request));
+	char *text = (char *)malloc((size_t)(len - KSE_SPEAK_HDR) + 1);
+	if (!r || !text) { free(r); free(text); send_end(c, id, KSE_FAILED, 0); return; }
+	r->conn    = c;
+	r->id      = id;
+	r->speed   = kse_getf(p + 4);
+	r->pitch   = kse_getf(p + 8);
+	r->lang    = p[12];
+	r->whisper = p[13];
+	r->cls     = p[14];
+	r->seed    = kse_get32(p + 16);
+	// the cache and the renderer stay float, replies are converted as they go out
+	r->fmt.format = (p[15] & ~KSE_FMT_DITHER) == KSE_FMT_S16 ? TTS_FMT_S16 :
+	                (p[15] & ~KSE_FMT_DITHER) == KSE_FMT_ULAW ? TTS_FMT_ULAW : TTS_FMT_F32;
+	r->fmt.dither = r->fmt.format == TTS_FMT_S16 && (p[15] & KSE_FMT_DITHER);
+	r->fmt.rng    = rng_mix(r->seed ^ id ^ 0xA5A5A5A5u) | 1u;
+	r->text    = text;
+	memcpy(text, p + KSE_SPEAK_HDR, (size_t)(len - KSE_SPEAK_HDR));
+	text[len - KSE_SPEAK_HDR] = '\0';
+	if (srv.cache && r->seed) cache_norm(text);
+	if (r->cls != KSE_INTERACTIVE && r->cls != KSE_BULK)
+		r->cls = len - KSE_SPEAK_HDR <= KSE_SHORT_TEXT ? KSE_INTERACTIVE : KSE_BULK;
+	r->queued_at = now_sec();
+	r->deadline  = r->queued_at + (srv.quantum == INT_MAX ? 0.0 : kse_target[r->cls]);
+
+	pthread_mutex_lock(&srv.lock);
+	srv.st.requests++;
+	if (srv.q_count + srv.active + srv.parked >= KSE_QUEUE) {
+		srv.st.busy++;
+		pthread_mutex_unlock(&srv.lock);
+		free(text); free(r);
+		send_end(c, id, KSE_BUSY, 0);
+		return;
+	}
+	c->refs++;
+	r->next  = srv.live;
+	srv.live = r;
+	r->order = srv.order++;
+	heap_push(r);
+	pthread_cond_signal(&srv.more);
+	pthread_mutex_unlock(&srv.lock);
+}
+
+// cancel a queued or running request of this connection
+static void on_cancel(Conn *c, uint32_t id)
+{
+	pthread_mutex_lock(&srv.lock);
+	for (Request *r = srv.live; r; r = r->next)
+		if (r->conn == c && r->id == id) __atomic_store_n(&r->cancel, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&srv.lock);
+	conn_wake(c);
+}
+
+// read what is there and handle every complete message, 0 drops the connection
+static int conn_read(Conn *c)
+{
+	if (c->in_cap - c->in_len < 4096) {
+		int nc = c->in_cap ? c->in_cap * 2 : 8192;
+		if (nc > KSE_MAX_MSG + 8) nc = KSE_MAX_MSG + 8;
+		if (nc <= c->in_len) return 0;
+		uint8_t *nb = (uint8_t *)realloc(c->in, (size_t)nc);
+		if (!nb) return 0;
+		c->in = nb; c->in_cap = nc;
+	}
+	ssize_t n = recv(c->fd, c->in + c->in_len, (size_t)(c->in_cap - c->in_len), MSG_DONTWAIT);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 1;
+	if (n <= 0) return 0;
+	c->in_len += (int)n;
+
+	int off = 0;
+	while (c->in_len - off >= 5) {
+		uint32_t mlen = kse_get32(c->in + off);
+		if (mlen < 1 || mlen > KSE_MAX_MSG) return 0;
+		if ((uint32_t)(c->in_len - off - 4) < mlen) break;
+		const uint8_t *m = c->in + off + 4;
+		int plen = (int)mlen - 1;
+		if (m[0] == KSE_SPEAK) on_speak(c, m + 1, plen);
+		else if (m[0] == KSE_CANCEL && plen >= 4) on_cancel(c, kse_get32(m + 1));
+		else if (m[0] == KSE_STATS) send_stats(c);
+		else return 0;
+		off += 4 + (int)mlen;
+	}
+	memmove(c->in, c->in + off, (size_t)(c->in_len - off));
+	c->in_len -= off;
+	return !__atomic_load_n(&c->closed, __ATOMIC_ACQUIRE);
+}
+
+static void conn_drop(Conn *c)
+{
+	__atomic_store_n(&c->closed, 1, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&srv.lock);
+	for (Request *r = srv.live; r; r = r->next)
+		if (r->conn == c) __atomic_store_n(&r->cancel, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&srv.lock);
+	conn_wake(c);
+	conn_unref(c);
+}
+
+static void on_signal(int sig) { (void)sig; kse_quit = 1; }
+
+static int listen_unix(const char *path)
+{
+	struct sockaddr_un a;
+	memset(&a, 0, sizeof(a));
+	a.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(a.sun_path)) return -1;
+	strcpy(a.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&a, sizeof(a)) < 0 || listen(fd, 128) < 0) { close(fd); return -1; }
+	return fd;
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = "/tmp/kse.sock";
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int workers = ncpu > 0 ? (int)ncpu : 1;
+	const char *cache_dir = NULL;
+	long long cache_mb = 1024;
+	srv.quantum = KSE_QUANTUM;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-s") && i + 1 < argc) path = argv[++i];
+		else if (!strcmp(argv[i], "-w") && i + 1 < argc) workers = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-q") && i + 1 < argc) srv.quantum = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-F")) srv.quantum = INT_MAX;
+		else if (!strcmp(argv[i], "-C") && i + 1 < argc) cache_dir = argv[++i];
+		else if (!strcmp(argv[i], "-M") && i + 1 < argc) cache_mb = atoll(argv[++i]);
+		else if (!strcmp(argv[i], "-T")) return tts_conformance(stdout) ? 1 : 0;
+		else if (!strcmp(argv[i], "-B")) { tts_bench(stdout); return 0; }
+		else {
+			fprintf(stderr, "usage: %s [-s socket] [-w workers] [-q quantum_blocks | -F] [-C cache_dir [-M cache_mb]] | -T | -B\n", argv[0]);
+			return 2;
+		}
+	}
+	if (srv.quantum < 1) srv.quantum = 1;
+	if (workers < 1) workers = 1;
+	if (workers > TTS_MAX_WORKERS) workers = TTS_MAX_WORKERS;
+
+	if (cache_dir) {
+		if (!tts_cache_open(cache_dir, cache_mb << 20)) { perror(cache_dir); return 1; }
+		srv.cache = 1;
+	}
+
+	int lfd = listen_unix(path);
+	if (lfd < 0) { perror(path); return 1; }
+	if (pipe(srv.wake) < 0) { perror("pipe"); return 1; }
+	fcntl(srv.wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(srv.wake[1], F_SETFL, O_NONBLOCK);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	// warm every context before the first request
+	for (int w = 0; w < workers; w++) {
+		kse_ctx[w].lang = LANG_AUTO; kse_ctx[w].read_speed = 1.0; kse_ctx[w].base_f0 = 120.0;
+		if (!ctx_scratch(&kse_ctx[w])) { fprintf(stderr, "out of memory\n"); return 1; }
+	}
+	srv.workers = workers;
+	srv.started = now_sec();
+	pthread_t tid[TTS_MAX_WORKERS];
+	for (int w = 0; w < workers; w++)
+		if (pthread_create(&tid[w], NULL, worker_main, (void *)(intptr_t)w) != 0) { srv.workers = w; break; }
+	fprintf(stderr, "kse-server: %s, %d workers, %s\n", path, srv.workers,
+	        srv.quantum == INT_MAX ? "first come first served" : "earliest deadline first");
+
+	// pfd[0] listens, pfd[1] is the wake pipe, connections follow
+	static struct pollfd pfd[KSE_MAX_CONNS + 2];
+	static Conn *conns[KSE_MAX_CONNS + 2];
+	int n = 2;
+	pfd[0].fd = lfd; pfd[0].events = POLLIN;
+	pfd[1].fd = srv.wake[0]; pfd[1].events = POLLIN;
+	while (!kse_quit) {
+		for (int i = 2; i < n; i++)
+			pfd[i].events = __atomic_load_n(&conns[i]->out_len, __ATOMIC_ACQUIRE) ? POLLIN | POLLOUT : POLLIN;
+		if (poll(pfd, (nfds_t)n, 200) < 0 && errno != EINTR) break;
+		if (pfd[1].revents & POLLIN) {
+			char b[256];
+			while (read(srv.wake[0], b, sizeof(b)) > 0) {}
+		}
+		for (int i = n - 1; i >= 2; i--) {
+			Conn *c = conns[i];
+			int drop = __atomic_load_n(&c->closed, __ATOMIC_ACQUIRE);
+			if (!drop && (pfd[i].revents & POLLOUT)) drop = !conn_flush(c);
+			if (!drop && (pfd[i].revents & (POLLIN | POLLHUP | POLLERR))) drop = !conn_read(c);
+			if (!drop) continue;
+			conn_drop(c);
+			pfd[i] = pfd[n - 1]; conns[i] = conns[n - 1];
+			n--;
+		}
+		if (pfd[0].revents & POLLIN) {
+			int fd = accept(lfd, NULL, NULL);
+			if (fd < 0) continue;
+			Conn *c = (Conn *)calloc(1, sizeof(Conn));
+			if (!c || n > KSE_MAX_CONNS + 1) { free(c); close(fd); continue; }
+			c->fd = fd;
+			c->refs = 1;
+			pthread_mutex_init(&c->wlock, NULL);
+			pthread_mutex_lock(&srv.lock);
+			srv.conns++;
+			srv.st.conns_total++;
+			pthread_mutex_unlock(&srv.lock);
+			pfd[n].fd = fd; pfd[n].events = POLLIN; pfd[n].revents = 0;
+			conns[n++] = c;
+		}
+	}
+
+	for (int i = 2; i < n; i++) conn_drop(conns[i]);
+	pthread_mutex_lock(&srv.lock);
+	srv.stop = 1;
+	pthread_cond_broadcast(&srv.more);
+	pthread_mutex_unlock(&srv.lock);
+	for (int w = 0; w < srv.workers; w++) pthread_join(tid[w], NULL);
+	close(lfd);
+	close(srv.wake[0]);
+	close(srv.wake[1]);
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+/* wire protocol of kse-server
+ * every message is a little-endian uint32 length (of what follows), one
+ * type byte, then the payload. a connection may have several requests in
+ * flight; replies carry the request id and the frames of different
+ * requests may interleave.
+ *
+ *   client -> server
+ *     KSE_SPEAK   u32 id, f32 speed, f32 pitch_hz, u8 lang (0 ru, 1 en, 2 auto),
+ *                 u8 whisper, u8 class (KSE_AUTO ...), u8 format (KSE_FMT_F32 ...,
+ *                 optionally | KSE_FMT_DITHER), u32 seed (0 = unseeded), utf-8 text
+ *     KSE_CANCEL  u32 id
+ *     KSE_STATS   (empty)
+ *
+ *   server -> client
+ *     KSE_PCM     u32 id, samples at KSE_SAMPLE_RATE in the request's format, mono
+ *     KSE_END     u32 id, u32 status (KSE_OK ...), u32 samples sent
+ *     KSE_STATSR  text, one "name value" per line
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#define KSE_SAMPLE_RATE  16000
+#define KSE_MAX_MSG      (1 << 20)   /* longest accepted message */
+#define KSE_SPEAK_HDR    20          /* speak payload before the text */
+
+enum {
+    KSE_SPEAK  = 1,
+    KSE_CANCEL = 2,
+    KSE_STATS  = 3,
+    KSE_PCM    = 0x81,
+    KSE_END    = 0x82,
+    KSE_STATSR = 0x83
+};
+
+/* scheduling class, auto picks interactive for short texts */
+enum {
+    KSE_AUTO        = 0,
+    KSE_INTERACTIVE = 1,
+    KSE_BULK        = 2,
+    KSE_CLASSES     = 3
+};
+
+/* sample format of the pcm replies, little-endian */
+enum {
+    KSE_FMT_F32    = 0,
+    KSE_FMT_S16    = 1,
+    KSE_FMT_ULAW   = 2,      /* g.711 mu-law */
+    KSE_FMT_DITHER = 0x80    /* flag: tpdf dither before 16 bit rounding */
+};
+
+static inline int kse_fmt_bytes(int format)
+{
+    format &= ~KSE_FMT_DITHER;
+    return format == KSE_FMT_S16 ? 2 : (format == KSE_FMT_ULAW ? 1 : 4);
+}
+
+enum {
+    KSE_OK        = 0,
+    KSE_CANCELLED = 1,
+    KSE_FAILED    = 2,
+    KSE_BUSY      = 3   /* queue full, nothing was rendered */
+};
+
+static inline void kse_put32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t kse_get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void kse_putf(uint8_t *p, float f)
+{
+    uint32_t v;
+    memcpy(&v, &f, 4);
+    kse_put32(p, v);
+}
+
+static inline float kse_getf(const uint8_t *p)
+{
+    uint32_t v = kse_get32(p);
+    float f;
+    memcpy(&f, &v, 4);
+    return f;
+}
+
+/* message header: length of type + payload, then the type */
+static inline void kse_header(uint8_t *p, uint8_t type, uint32_t payload)
+{
+    kse_put32(p, payload + 1);
+    p[4] = type;
+}
@@ -675,11 +675,26 @@ static char *en_expand_input(const char *in)
 
 // phoneme lookup and classification
 
+// direct index over the pua code range instead of a table scan. built
+// before main, so threads only ever read it
+#define EN_CODE_BASE   0xE000u
+#define EN_CODE_RANGE  0x80u
+
+static PhonemeDef *en_phoneme_index[EN_CODE_RANGE];
+
+__attribute__((constructor))
+static void en_phoneme_index_build(void)
+{
+    for (int i = 0; en_phonemes[i].code != 0; i++) {
+        uint32_t slot = en_phonemes[i].code - EN_CODE_BASE;
+        if (slot < EN_CODE_RANGE && !en_phoneme_index[slot]) en_phoneme_index[slot] = &en_phonemes[i];
+    }
+}
+
 static PhonemeDef *en_find_phoneme(uint32_t code)
 {
-    for (int i = 0; en_phonemes[i].code != 0; i++)
-        if (en_phonemes[i].code == code) return &en_phonemes[i];
-        return NULL;
+    uint32_t slot = code - EN_CODE_BASE;
+    return (slot < EN_CODE_RANGE) ? en_phoneme_index[slot] : NULL;
 }
 
 static inline int en_is_vowel(uint32_t c)
@@ -0,0 +1,112 @@
+// audio worklet side of the time-scale and pitch engine
+// built as a standalone wasm so the worklet can run it without the
+// emscripten glue: fill dsp_alloc(), dsp_start(), then dsp_process() per block
+#include "tts_tsm.h"
+
+#include <stdlib.h>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h>
+#endif
+
+#define DSP_BLOCK 1024
+
+static TSMState dsp_state;
+static float   *dsp_in     = NULL;
+static int      dsp_in_cap = 0;
+static float    dsp_out_buf[DSP_BLOCK];
+
+// input storage for len samples, caller copies the rendered buffer here
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+float *dsp_alloc(int len)
+{
+	if (len <= 0) return NULL;
+	if (len > dsp_in_cap) {
+		float *nb = (float *)realloc(dsp_in, (size_t)len * sizeof(float));
+		if (!nb) return NULL;
+		dsp_in     = nb;
+		dsp_in_cap = len;
+	}
+	return dsp_in;
+}
+
+// start playback of the first len samples of the input storage
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int dsp_start(int len, int sample_rate)
+{
+	if (!dsp_in || len <= 0 || len > dsp_in_cap) return 0;
+	tsm_init(&dsp_state, dsp_in, len, sample_rate);
+	return 1;
+}
+
+// start on input that is still arriving, dsp_alloc() must cover the whole
+// utterance; report progress with dsp_extend()
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int dsp_start_stream(int sample_rate)
+{
+	if (!dsp_in) return 0;
+	tsm_init(&dsp_state, dsp_in, 0, sample_rate);
+	tsm_extend(&dsp_state, 0, 0);
+	return 1;
+}
+
+// the first len samples of the input storage are filled, final once complete
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+void dsp_extend(int len, int final)
+{
+	if (len > dsp_in_cap) len = dsp_in_cap;
+	tsm_extend(&dsp_state, len, final);
+}
+
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int dsp_done(void) { return dsp_state.in ? tsm_done(&dsp_state) : 1; }
+
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+void dsp_params(double speed, double pitch)
+{
+	tsm_set_params(&dsp_state, (float)speed, (float)pitch);
+}
+
+// render up to n samples into dsp_out(), fewer means the end was reached
+// (dsp_done) or the streamed input has not caught up
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int dsp_process(int n)
+{
+	if (!dsp_state.in || n <= 0) return 0;
+	if (n > DSP_BLOCK) n = DSP_BLOCK;
+	return tsm_process(&dsp_state, dsp_out_buf, n);
+}
+
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+float *dsp_out(void) { return dsp_out_buf; }
+
+// continue from input sample pos, for looping and scrubbing
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+void dsp_seek(int pos)
+{
+	if (dsp_state.in) tsm_seek(&dsp_state, pos);
+}
+
+// input sample reached so far, for progress display
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int dsp_position(void) { return dsp_state.in ? tsm_position(&dsp_state) : 0; }
@@ -1,5 +1,9 @@
 // it works a bit better idk why
 #include "tts_synth.h"
+#include "tts_compiled.h"
+#include "tts_tsm.h"
+#include "tts_codec.h"
+#include "tts_wav.h"
 #include "lang_ru.h"
 #include "lang_en.h"
 
@@ -11,6 +15,15 @@
 #include <stdint.h>
 #include <ctype.h>
 
+#ifndef __EMSCRIPTEN__
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
@@ -36,101 +49,118 @@ extern int         en_is_diphthong_onset(uint32_t c);
 
 #define MIN_FRAME_DUR  0.004
 
+// threads are available natively and in pthread-enabled wasm builds
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#define TTS_HAVE_THREADS 1
+#include <pthread.h>
+#endif
+
+#define TTS_MAX_WORKERS 16
+
 // global state
 typedef enum { LANG_RU=0, LANG_EN=1, LANG_AUTO=2 } LangID;
-static LangID  current_lang    = LANG_AUTO;
-static double  tts_read_speed  = 1.0;
-static double  prosody_base_f0 = 120.0;
 
-static int whisper_mode = 0;
+// one phone of the utterance timeline, four 32 bit words so js can read
+// it through an Int32Array (and the amplitude through a Float32Array)
+typedef struct TimelineRun {
+	int32_t  start;   // first sample, at the utterance's rate
+	uint32_t code;    // phone code or punctuation codepoint, 0 ends the list
+	int32_t  kind;    // PhType | FRAME_* flags << 8
+	float    amp;     // peak frame amplitude
+} TimelineRun;
+
+// engine context voice settings noise generator reusable scratch and output
+// the public api drives tts_ctx, worker threads own their own contexts
+typedef struct TTSContext {
+	LangID   lang;
+	double   read_speed;
+	double   base_f0;
+	int      whisper;
+	int      voice;       // voice_presets index
+	uint32_t seed;        // 0 seeds from the clock on first use
+	uint32_t rng;
+	int      format;      // TTS_FMT_* written by the single-utterance calls
+	int      dither;      // tpdf dither before 16 bit rounding
+	int      sample_rate; // output rate, 0 for SAMPLE_RATE
+
+	// scratch reused across utterances
+	uint32_t          *codes;   // MAX_UTF8_CP codepoints
+	uint32_t          *norm;    // MAX_UTF8_CP / 2 normalised codepoints
+	struct RunEntry   *runs;    // MAX_UTF8_CP / 2 + 4 runs
+	struct WordPhones *wp;
+	TTSSeq            *seq;
+	uint32_t           builds;  // bumped by every build_sequence
+	struct TimelineRun *tl;     // phone runs of the last build, see timeline_build
+	int                tl_len, tl_cap;
+
+	// rendered output grows but never shrinks
+	float *out;
+	int    out_len, out_cap;
+} TTSContext;
+
+static TTSContext tts_ctx = { .lang = LANG_AUTO, .read_speed = 1.0, .base_f0 = 120.0 };
 
 #ifdef __EMSCRIPTEN__
 EMSCRIPTEN_KEEPALIVE
 #endif
 void tts_set_whisper(int enable)
 {
-	whisper_mode = (enable != 0) ? 1 : 0;
+	tts_ctx.whisper = (enable != 0) ? 1 : 0;
 }
 
-// biquad filter initialisation helpers
-static void _init_bandpass_w(double fs, double f0, double Q,
-							 double *b0, double *b1, double *b2,
-							 double *a1, double *a2)
-{
-	if (f0 <= 0.0 || Q <= 0.0) { *b0=*b1=*b2=*a1=*a2=0.0; return; }
-	double w0    = TWO_PI * f0 / fs;
-	double alpha = sin(w0) / (2.0 * Q);
-	double cosw0 = cos(w0);
-	double a0    = 1.0 + alpha;
-	*b0 =  alpha / a0;  *b1 = 0.0;  *b2 = -alpha / a0;
-	*a1 = -2.0 * cosw0 / a0;
-	*a2 = (1.0 - alpha) / a0;
-}
+// voice presets: a vocal tract and glottis scale and a reading pace,
+// applied through the frame builder's voice transform (see VoiceXform).
+// whisper composes on top of any of them
+typedef struct {
+	const char *name;
+	float       formants, pitch, speed;
+} VoicePreset;
+
+static const VoicePreset voice_presets[] = {
+	{ "default", 1.00f, 1.00f, 1.00f },
+	{ "deep",    0.88f, 0.78f, 0.94f },
+	{ "bright",  1.10f, 1.22f, 1.04f },
+	{ "child",   1.22f, 1.75f, 1.08f },
+};
+#define VOICE_PRESETS (int)(sizeof(voice_presets) / sizeof(voice_presets[0]))
 
-static void _init_lowpass_w(double fs, double fc,
-							double *b0, double *b1, double *b2,
-							double *a1, double *a2)
-{
-	double w0    = TWO_PI * fc / fs;
-	double alpha = sin(w0) / (2.0 * 0.707);
-	double cosw0 = cos(w0);
-	double a0    = 1.0 + alpha;
-	*b0 = (1.0 - cosw0) / (2.0 * a0);
-	*b1 = (1.0 - cosw0) / a0;
-	*b2 = (1.0 - cosw0) / (2.0 * a0);
-	*a1 = -2.0 * cosw0 / a0;
-	*a2 = (1.0 - alpha) / a0;
-}
+// reading pace and prosody f0 with the voice preset applied
+static inline double ctx_speed(const TTSContext *ctx) { return ctx->read_speed * voice_presets[ctx->voice].speed; }
+static inline double ctx_f0(const TTSContext *ctx)    { return ctx->base_f0 * voice_presets[ctx->voice].pitch; }
 
-// whisper transform
-static void whisper_patch_frame(FormantData *fd)
+// voice transform of ctx's preset and whisper, NULL when it changes nothing
+static const VoiceXform *ctx_xform(const TTSContext *ctx, VoiceXform *x)
 {
-	if (!fd) return;
-	if (fd->type == vtype_silence) return;
-
-	if (fd->type == vtype_vowel) {
-		double f1w = fd->f[0] * 1.15;
-		double f2w = fd->f[1] * 0.95;
-		if (f1w > 1200.0) f1w = 1200.0;
-		if (f2w > 3200.0) f2w = 3200.0;
-		if (f1w < 100.0)  f1w = 100.0;
-		if (f2w < 400.0)  f2w = 400.0;
-
-		_init_bandpass_w(SAMPLE_RATE, f1w, 2.5,
-						 &fd->b0[0], &fd->b1[0], &fd->b2[0], &fd->a1[0], &fd->a2[0]);
-		_init_bandpass_w(SAMPLE_RATE, f2w, 2.0,
-						 &fd->b0[1], &fd->b1[1], &fd->b2[1], &fd->a1[1], &fd->a2[1]);
-		_init_lowpass_w(SAMPLE_RATE, f2w * 1.25,
-						&fd->lp_b0, &fd->lp_b1, &fd->lp_b2, &fd->lp_a1, &fd->lp_a2);
-
-		for (int j = 0; j < 3; j++) fd->x1[j]=fd->x2[j]=fd->y1[j]=fd->y2[j]=0.0;
-		fd->lp_x1=fd->lp_x2=fd->lp_y1=fd->lp_y2=0.0;
-
-		fd->type      = vtype_fricative;
-		fd->is_voiced = 0;
-		fd->amplitude *= 1.8;
-		if (fd->amplitude > 1.0) fd->amplitude = 1.0;
-
-	} else if (fd->type == vtype_consonant && fd->is_voiced) {
-		fd->is_voiced  = 0;
-		fd->amplitude *= 1.3;
-		if (fd->amplitude > 1.0) fd->amplitude = 1.0;
-
-	} else if (fd->type == vtype_stop && fd->is_voiced) {
-		fd->is_voiced = 0;
+	const VoicePreset *vp = &voice_presets[ctx->voice];
+	if (vp->formants == 1.0f && vp->pitch == 1.0f && !ctx->whisper) return NULL;
+	vx_tract(x, vp->formants, vp->pitch);
+	if (ctx->whisper) {
+		VoiceXform w;
+		vx_whisper(&w);
+		vx_then(x, &w);
 	}
+	return x;
 }
 
-static void whisper_transform_seq(TTSSeq *seq)
+// pick a preset for the next builds, returns the one in use
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_set_voice(int preset)
 {
-	if (!seq || !seq->seq || seq->seqLen <= 0) return;
-	for (int i = 0; i < seq->seqLen; i++)
-		whisper_patch_frame(&seq->seq[i]);
+	tts_ctx.voice = (preset >= 0 && preset < VOICE_PRESETS) ? preset : 0;
+	return tts_ctx.voice;
 }
 
+// name of preset i, NULL past the last one
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+const char *tts_get_voice_name(int i) { return (i >= 0 && i < VOICE_PRESETS) ? voice_presets[i].name : NULL; }
+
 // post-processing normalise -> lp -> dc block -> soft limiter
 typedef struct { float b0,b1,b2,a1,a2,x1,x2,y1,y2; } LPF2;
-typedef struct { float x1,y1; } DCB;
+typedef struct { float x1,y1,r; } DCB;
 
 static void lpf2_init(LPF2 *f, float fc, int sr)
 {
@@ -147,7 +177,7 @@ static void lpf2_init(LPF2 *f, float fc, int sr)
 
 static inline float lpf2_proc(LPF2 *f, float x)
 {
-	float y = f->b0*x + f->b1*f->x1 + f->b2*f->x2 - f->a1*f->y1 - f->a2*f->y2;
+	float y = kn_flushf(f->b0*x + f->b1*f->x1 + f->b2*f->x2 - f->a1*f->y1 - f->a2*f->y2);
 	f->x2 = f->x1; f->x1 = x;
 	f->y2 = f->y1; f->y1 = y;
 	return y;
@@ -155,12 +185,80 @@ static inline float lpf2_proc(LPF2 *f, float x)
 
 static inline float dcb_proc(DCB *f, float x)
 {
-	float y = x - f->x1 + 0.998f * f->y1;
+	float y = kn_flushf(x - f->x1 + f->r * f->y1);
 	f->x1 = x; f->y1 = y;
 	return y;
 }
 
-static void postprocess(float *buf, int n, int sr)
+// filter chain after normalisation, kept as state so it can also run block by block
+typedef struct { LPF2 lp1, lp2; DCB dc; } PostFX;
+
+static void postfx_init(PostFX *p, int sr)
+{
+	// gentle lp at 7500 hz remove aliasing artefacts, below nyquist at low rates.
+	// the dc blocker keeps its ~5 hz corner at any rate
+	float fc = 0.47f * (float)sr < 7500.f ? 0.47f * (float)sr : 7500.f;
+	lpf2_init(&p->lp1, fc, sr);
+	lpf2_init(&p->lp2, fc, sr);
+	p->dc.x1 = p->dc.y1 = 0.0f;
+	p->dc.r  = (float)pow(0.998, (double)SAMPLE_RATE / sr);
+}
+
+static inline float postfx_proc(PostFX *p, float s)
+{
+	// soft limiter tanh with slight drive
+	const float drive     = 1.4f;
+	const float inv_drive = 1.0f / drive;
+
+	s = lpf2_proc(&p->lp1, s);
+	s = lpf2_proc(&p->lp2, s);
+	s = dcb_proc(&p->dc, s);
+	return tanhf(s * drive) * inv_drive;
+}
+
+// output sample formats. the conversion happens where the last filter
+// pass stores its result, so compact output costs no extra pass and
+// writes a half or a quarter of the bytes
+enum { TTS_FMT_F32 = 0, TTS_FMT_S16 = 1, TTS_FMT_ULAW = 2 };
+
+typedef struct {
+	int      format;
+	int      dither;
+	uint32_t rng;
+} OutFmt;
+
+static inline int fmt_bytes(int format)
+{
+	return format == TTS_FMT_S16 ? 2 : (format == TTS_FMT_ULAW ? 1 : 4);
+}
+
+// s as a 16 bit sample, dithered when f asks for it
+static inline int16_t fmt_s16(OutFmt *f, float s)
+{
+	if (f->dither) {
+		// difference of two uniform 16 bit draws, triangular over +-1 lsb
+		uint32_t r = rng_next(&f->rng);
+		s += ((float)(r & 0xFFFF) - (float)(r >> 16)) * (1.0f / 65536.0f / 32767.0f);
+	}
+	return (int16_t)codec_s16(s);
+}
+
+// store sample i of dst. dst may be the float source itself: a compact
+// sample lands below the floats still to be read
+static inline void fmt_store(OutFmt *f, void *dst, int i, float s)
+{
+	if (f->format == TTS_FMT_S16) {
+		((int16_t *)dst)[i] = fmt_s16(f, s);
+	} else if (f->format == TTS_FMT_ULAW) {
+		((uint8_t *)dst)[i] = ulaw_encode1(s);
+	} else {
+		((float *)dst)[i] = s;
+	}
+}
+
+// normalise buf in place, then run the filter chain from buf into dst in
+// the format of of (NULL for float). dst may be buf
+static void postprocess_to(float *buf, int n, int sr, OutFmt *of, void *dst)
 {
 	if (!buf || n <= 0) return;
 
@@ -172,38 +270,31 @@ static void postprocess(float *buf, int n, int sr)
 		for (int i = 0; i < n; i++) buf[i] *= s;
 	}
 
-	// gentle lp at 7500 hz remove aliasing artefacts
-	LPF2 lp1, lp2;
-	lpf2_init(&lp1, 7500.f, sr);
-	lpf2_init(&lp2, 7500.f, sr);
-
-	DCB dc = {0, 0};
-
-	// soft limiter tanh with slight drive
-	const float drive     = 1.4f;
-	const float inv_drive = 1.0f / drive;
-
-	for (int i = 0; i < n; i++) {
-		float s = lpf2_proc(&lp1, buf[i]);
-		s = lpf2_proc(&lp2, s);
-		s = dcb_proc(&dc, s);
-		buf[i] = tanhf(s * drive) * inv_drive;
+	PostFX fx;
+	postfx_init(&fx, sr);
+	unsigned fpmode = kn_denormals_off();
+	if (!of || of->format == TTS_FMT_F32) {
+		float *out = (float *)dst;
+		for (int i = 0; i < n; i++) out[i] = postfx_proc(&fx, buf[i]);
+	} else {
+		for (int i = 0; i < n; i++) fmt_store(of, dst, i, postfx_proc(&fx, buf[i]));
 	}
+	kn_denormals_restore(fpmode);
 }
 
+static void postprocess(float *buf, int n, int sr) { postprocess_to(buf, n, sr, NULL, buf); }
+
 // frame helpers
-static inline void push_frame(FormantData *seq, int *idx,
-							  const PhonemeDef *pd, uint32_t code,
+static inline void push_frame(TTSSeq *seq, const PhonemeDef *pd, uint32_t code,
 							  double dur, uint32_t f0_hz)
 {
 	if (dur < MIN_FRAME_DUR) dur = MIN_FRAME_DUR;
-	setup_formant(&seq[*idx], (PhonemeDef *)pd, code, dur);
-	seq[*idx].dbg_code = f0_hz;
-	(*idx)++;
+	int i = seq_push(seq, pd, code, dur);
+	if (i >= 0) seq->f0[i] = (uint16_t)(f0_hz > 0xFFFFu ? 0xFFFFu : f0_hz);
 }
 
 // interpolate two phoneme defs by t in [0,1] and push as one frame
-static void interp_frame(FormantData *seq, int *idx,
+static void interp_frame(TTSSeq *seq,
 						 const PhonemeDef *a, const PhonemeDef *b,
 						 double t, double dur, uint32_t f0_hz)
 {
@@ -213,7 +304,7 @@ static void interp_frame(FormantData *seq, int *idx,
 	mid.f3  = (int)(a->f3  + (b->f3  - a->f3)  * t);
 	mid.amp = (float)(a->amp + (b->amp - a->amp) * t);
 	mid.duration = dur;
-	push_frame(seq, idx, &mid, a->code, dur, f0_hz);
+	push_frame(seq, &mid, a->code, dur, f0_hz);
 }
 
 // stop burst model
@@ -255,13 +346,13 @@ static int affricate_index(uint32_t code)
 // expand_phone convert single phoneme into one or more formant frames
 // handles stops affricates fricatives vowels sonorants diphthongs approximants and default fallback
 static void expand_phone(
-	FormantData *seq, int *idx, int seq_cap,
+	const TTSContext *ctx, TTSSeq *seq, int seq_cap,
 	uint32_t code, const PhonemeDef *pd,
 	const PhonemeDef *prev_pd, const PhonemeDef *next_pd,
 	double dur_scale, double amp_scale, uint32_t f0_hz)
 {
-	if (*idx >= seq_cap - 16) return;
-	double spd = tts_read_speed;
+	if (seq->seqLen >= seq_cap - 16) return;
+	double spd = ctx_speed(ctx);
 
 	// stop consonants
 	int si = stop_index(code);
@@ -279,12 +370,12 @@ static void expand_phone(
 			vb.code = code; vb.f1 = 160; vb.f2 = lf2; vb.f3 = 2400;
 			vb.duration = clos * 0.001; vb.type = vtype_consonant;
 			vb.amp = 0.14f; vb.is_voiced = 1;
-			push_frame(seq, idx, &vb, code, vb.duration, f0_hz);
+			push_frame(seq, &vb, code, vb.duration, f0_hz);
 		} else {
 			// voiceless stop silence for closure
 			PhonemeDef cl; memset(&cl, 0, sizeof(cl));
 			cl.duration = clos * 0.001; cl.type = vtype_silence; cl.amp = 0.0f;
-			push_frame(seq, idx, &cl, code, cl.duration, f0_hz);
+			push_frame(seq, &cl, code, cl.duration, f0_hz);
 
 			if (asp > 0.0f) {
 				// aspiration noise shaped by following vowel formants
@@ -299,7 +390,7 @@ static void expand_phone(
 				ap.type = vtype_fricative;
 				ap.amp  = 0.22f;
 				ap.is_voiced = 0;
-				push_frame(seq, idx, &ap, ap.code, ap.duration, f0_hz);
+				push_frame(seq, &ap, ap.code, ap.duration, f0_hz);
 			}
 		}
 
@@ -314,7 +405,7 @@ static void expand_phone(
 		bst.type      = vtype_fricative;   // noise source for burst
 		bst.is_voiced = isvd;
 		bst.amp       = (float)(pd->amp * amp_scale * 1.10);
-		push_frame(seq, idx, &bst, code, bst.duration, f0_hz);
+		push_frame(seq, &bst, code, bst.duration, f0_hz);
 		return;
 	}
 
@@ -330,11 +421,11 @@ static void expand_phone(
 			vb.code = code; vb.f1 = 180; vb.f2 = 1800; vb.f3 = 2600;
 			vb.duration = cl_dur; vb.type = vtype_consonant;
 			vb.amp = 0.15f; vb.is_voiced = 1;
-			push_frame(seq, idx, &vb, code, vb.duration, f0_hz);
+			push_frame(seq, &vb, code, vb.duration, f0_hz);
 		} else {
 			PhonemeDef cl; memset(&cl, 0, sizeof(cl));
 			cl.duration = cl_dur; cl.type = vtype_silence; cl.amp = 0.0f;
-			push_frame(seq, idx, &cl, code, cl.duration, f0_hz);
+			push_frame(seq, &cl, code, cl.duration, f0_hz);
 		}
 		// fricative release sh-like
 		double fr_dur = 0.080 * dur_scale / spd;
@@ -343,7 +434,7 @@ static void expand_phone(
 		fr.f1 = 1800; fr.f2 = 3500; fr.duration = fr_dur;
 		fr.type = vtype_fricative;
 		fr.amp  = (float)(pd->amp * amp_scale);
-		push_frame(seq, idx, &fr, code, fr.duration, f0_hz);
+		push_frame(seq, &fr, code, fr.duration, f0_hz);
 		return;
 	}
 
@@ -362,15 +453,15 @@ static void expand_phone(
 
 		PhonemeDef on = *pd;
 		on.duration = ramp; on.amp = (float)(fric_amp * 0.30);
-		push_frame(seq, idx, &on, code, on.duration, f0_hz);
+		push_frame(seq, &on, code, on.duration, f0_hz);
 
 		PhonemeDef bd = *pd;
 		bd.duration = body; bd.amp = (float)fric_amp;
-		push_frame(seq, idx, &bd, code, bd.duration, f0_hz);
+		push_frame(seq, &bd, code, bd.duration, f0_hz);
 
 		PhonemeDef off = *pd;
 		off.duration = ramp; off.amp = (float)(fric_amp * 0.20);
-		push_frame(seq, idx, &off, code, off.duration, f0_hz);
+		push_frame(seq, &off, code, off.duration, f0_hz);
 		return;
 	}
 
@@ -390,7 +481,7 @@ static void expand_phone(
 			double tdur = 0.025 / spd;
 			if (tdur < MIN_FRAME_DUR) tdur = MIN_FRAME_DUR;
 			// interpolate from locus to target in one frame
-			interp_frame(seq, idx, &locus, pd, 0.6, tdur, f0_hz);
+			interp_frame(seq, &locus, pd, 0.6, tdur, f0_hz);
 		}
 
 		// main frame
@@ -399,7 +490,7 @@ static void expand_phone(
 		PhonemeDef main_pd = *pd;
 		main_pd.amp = (float)(pd->amp * amp_scale);
 		main_pd.duration = dur;
-		push_frame(seq, idx, &main_pd, code, dur, f0_hz);
+		push_frame(seq, &main_pd, code, dur, f0_hz);
 
 		// diphthong onsets glide handling left to sequencer
 		if (en_is_diphthong_onset(code)) {
@@ -414,7 +505,7 @@ static void expand_phone(
 	if (dur < MIN_FRAME_DUR) dur = MIN_FRAME_DUR;
 	PhonemeDef fallback = *pd;
 	fallback.amp = (float)(pd->amp * amp_scale);
-	push_frame(seq, idx, &fallback, code, dur, f0_hz);
+	push_frame(seq, &fallback, code, dur, f0_hz);
 }
 
 // stress assignment simplified rules based on espeak-ng cmu ideas
@@ -514,61 +605,75 @@ static void compute_prosody(const uint32_t *phones, int n,
 	}
 }
 
-// english sequence builder
-static TTSSeq *prepare_sequence_en(const uint32_t *norm, int ni)
+// per-word phone vector
+// coarticulated definitions and prosody for every phone of one word
+// computed once in a single pass then fed to expand_phone
+typedef struct WordPhones {
+	uint32_t   phones[MAX_PHONES];
+	PhonemeDef def[MAX_PHONES];
+	Prosody    pr[MAX_PHONES];
+	int        n;
+} WordPhones;
+
+static void word_phones_build(WordPhones *w, int is_question, float base_f0)
+{
+	int n = w->n;
+	int si = find_stress(w->phones, n);
+	compute_prosody(w->phones, n, si, is_question, base_f0, w->pr);
+	for (int i = 0; i < n; i++) {
+		uint32_t pc = (i > 0)     ? w->phones[i-1] : 0;
+		uint32_t nc = (i < n - 1) ? w->phones[i+1] : 0;
+		en_coarticulate_context(pc, w->phones[i], nc, &w->def[i]);
+	}
+}
+
+static void word_phones_expand(const TTSContext *ctx, const WordPhones *w, TTSSeq *seq)
 {
-	if (!norm || ni <= 0) return NULL;
+	int n = w->n;
+	for (int i = 0; i < n && seq->seqLen < MAX_FRAMES - 18; i++) {
+		const PhonemeDef *ppd = (i > 0)     ? &w->def[i-1] : NULL;
+		const PhonemeDef *npd = (i < n - 1) ? &w->def[i+1] : NULL;
+		expand_phone(ctx, seq, MAX_FRAMES,
+					 w->phones[i], &w->def[i], ppd, npd,
+					 w->pr[i].dur_scale, w->pr[i].amp_scale,
+					 (uint32_t)roundf(w->pr[i].f0));
+	}
+}
 
-	FormantData *seq = (FormantData *)calloc((size_t)MAX_FRAMES, sizeof(FormantData));
-	if (!seq) return NULL;
-	int seq_len = 0;
+// english sequence builder appends to seq, returns frames added
+static int prepare_sequence_en(TTSContext *ctx, const uint32_t *norm, int ni, TTSSeq *seq)
+{
+	if (!norm || ni <= 0 || !seq) return 0;
+	WordPhones *wp = ctx->wp;
+	int start = seq->seqLen;
 
 	int is_question = 0;
 	for (int i = 0; i < ni; i++) if (norm[i] == '?') { is_question = 1; break; }
 
 	char     word_buf[MAX_WORD];
 	int      wlen = 0;
-	uint32_t phones[MAX_PHONES];
 
 	#define FLUSH_WORD() do { \
 	if (wlen > 0) { \
 		word_buf[wlen] = '\0'; \
-		int nph = en_grapheme_to_phonemes(word_buf, phones, MAX_PHONES); \
-		if (nph > 0) { \
-			int si = find_stress(phones, nph); \
-			Prosody pr[MAX_PHONES]; \
-			compute_prosody(phones, nph, si, is_question, (float)prosody_base_f0, pr); \
-			for (int pi = 0; pi < nph && seq_len < MAX_FRAMES - 18; pi++) { \
-				PhonemeDef pd; \
-				uint32_t pc = (pi > 0)       ? phones[pi-1] : 0; \
-				uint32_t nc = (pi < nph - 1)  ? phones[pi+1] : 0; \
-				en_coarticulate_context(pc, phones[pi], nc, &pd); \
-				PhonemeDef ppd_s, npd_s, *ppd = NULL, *npd = NULL; \
-				if (pc) { en_coarticulate_context(0, pc, phones[pi], &ppd_s); ppd = &ppd_s; } \
-					if (nc) { en_coarticulate_context(phones[pi], nc, 0, &npd_s); npd = &npd_s; } \
-						expand_phone(seq, &seq_len, MAX_FRAMES, \
-						phones[pi], &pd, ppd, npd, \
-						pr[pi].dur_scale, pr[pi].amp_scale, \
-						(uint32_t)roundf(pr[pi].f0)); \
-			} \
+		wp->n = en_grapheme_to_phonemes(word_buf, wp->phones, MAX_PHONES); \
+		if (wp->n > 0) { \
+			word_phones_build(wp, is_question, (float)ctx_f0(ctx)); \
+			word_phones_expand(ctx, wp, seq); \
 		} \
 		wlen = 0; \
 	} \
 	} while (0)
 
-	for (int i = 0; i < ni && seq_len < MAX_FRAMES - 18; i++) {
+	for (int i = 0; i < ni && seq->seqLen < MAX_FRAMES - 18; i++) {
 		uint32_t cp = norm[i];
 		double psec = en_punctuation_pause(cp);
 		if (psec > 0.0 || cp == 0) {
 			FLUSH_WORD();
 			if (psec > 0.0) {
-				int ts = (int)ceil(psec * SAMPLE_RATE / tts_read_speed);
+				int ts = (int)ceil(psec * seq->sample_rate / ctx_speed(ctx));
 				if (ts < 2) ts = 2;
-				seq[seq_len].sampleRate   = SAMPLE_RATE;
-				seq[seq_len].totalSamples = ts;
-				seq[seq_len].type         = vtype_silence;
-				seq[seq_len].dbg_code     = cp;
-				seq_len++;
+				seq_push_silence(seq, ts, cp);
 			}
 			continue;
 		}
@@ -584,19 +689,11 @@ static TTSSeq *prepare_sequence_en(const uint32_t *norm, int ni)
 	FLUSH_WORD();
 	#undef FLUSH_WORD
 
-	if (seq_len == 0) { free(seq); return NULL; }
-
-	FormantData *s2 = (FormantData *)realloc(seq, (size_t)seq_len * sizeof(FormantData));
-	if (s2) seq = s2;
-
-	TTSSeq *tts = (TTSSeq *)malloc(sizeof(TTSSeq));
-	if (!tts) { free(seq); return NULL; }
-	tts->seq = seq; tts->seqLen = seq_len; tts->currentIndex = 0;
-	return tts;
+	return seq->seqLen - start;
 }
 
 // russian sequence builder unchanged logic preserved
-typedef struct { uint32_t cp; int count; } RunEntry;
+typedef struct RunEntry { uint32_t cp; int count; } RunEntry;
 
 static int collapse_runs(const uint32_t *norm, int ni, RunEntry *runs, int rc)
 {
@@ -612,26 +709,20 @@ static int collapse_runs(const uint32_t *norm, int ni, RunEntry *runs, int rc)
 	return ri;
 }
 
-static TTSSeq *prepare_sequence_ru(const uint32_t *norm, int ni)
+static int prepare_sequence_ru(TTSContext *ctx, const uint32_t *norm, int ni, TTSSeq *seq)
 {
-	if (!norm || ni <= 0) return NULL;
-	int mr = ni + 4;
-	RunEntry *runs = (RunEntry *)malloc((size_t)mr * sizeof(RunEntry));
-	if (!runs) return NULL;
-	int nruns = collapse_runs(norm, ni, runs, mr);
-
-	FormantData *seq = (FormantData *)calloc((size_t)nruns + 8, sizeof(FormantData));
-	if (!seq) { free(runs); return NULL; }
-	int sl = 0;
+	if (!norm || ni <= 0 || !seq) return 0;
+	RunEntry *runs = ctx->runs;
+	int nruns = collapse_runs(norm, ni, runs, MAX_UTF8_CP / 2 + 4);
+	int start = seq->seqLen;
 
 	for (int i = 0; i < nruns; i++) {
 		uint32_t cp = runs[i].cp; int cnt = runs[i].count;
 		double ps = ru_punctuation_pause(cp);
 		if (ps > 0.0) {
-			int ts = (int)ceil(ps * cnt * SAMPLE_RATE / tts_read_speed);
+			int ts = (int)ceil(ps * cnt * seq->sample_rate / ctx_speed(ctx));
 			if (ts < 2) ts = 2;
-			seq[sl].sampleRate = SAMPLE_RATE; seq[sl].totalSamples = ts;
-			seq[sl].type = vtype_silence; seq[sl].dbg_code = cp; sl++;
+			seq_push_silence(seq, ts, cp);
 			continue;
 		}
 		if (cp == 0) continue;
@@ -639,23 +730,16 @@ static TTSSeq *prepare_sequence_ru(const uint32_t *norm, int ni)
 		for (int k = 0; ru_phonemes[k].code != 0; k++)
 			if (ru_phonemes[k].code == cp) { pd = &ru_phonemes[k]; break; }
 			if (!pd) {
-				int ts = (int)ceil(0.04 * SAMPLE_RATE / tts_read_speed); if (ts < 2) ts = 2;
-				seq[sl].sampleRate = SAMPLE_RATE; seq[sl].totalSamples = ts;
-				seq[sl].type = vtype_silence; seq[sl].dbg_code = cp; sl++;
+				int ts = (int)ceil(0.04 * seq->sample_rate / ctx_speed(ctx)); if (ts < 2) ts = 2;
+				seq_push_silence(seq, ts, cp);
 				continue;
 			}
 			if (pd->type == vtype_silence && cp == 0x042C) continue;
-			double dur = pd->duration * (double)cnt / tts_read_speed;
+			double dur = pd->duration * (double)cnt / ctx_speed(ctx);
 		if (dur < MIN_FRAME_DUR) dur = MIN_FRAME_DUR;
-		setup_formant(&seq[sl], pd, cp, dur); sl++;
+		seq_push(seq, pd, cp, dur);
 	}
-	free(runs);
-	if (sl == 0) { free(seq); return NULL; }
-
-	TTSSeq *tts = (TTSSeq *)malloc(sizeof(TTSSeq));
-	if (!tts) { free(seq); return NULL; }
-	tts->seq = seq; tts->seqLen = sl; tts->currentIndex = 0;
-	return tts;
+	return seq->seqLen - start;
 }
 
 // language detection simple ru/en counters using utf8 patterns
@@ -705,106 +789,2270 @@ static int utf8_to_cp(const char *s, uint32_t *o, int max)
 	return n;
 }
 
-// output buffer
-static float *tts_output_buf = NULL;
-static int    tts_output_len = 0;
+// context helpers
+static void ctx_free(TTSContext *ctx)
+{
+	free(ctx->codes); free(ctx->norm); free(ctx->runs); free(ctx->wp);
+	free_tts(ctx->seq); free(ctx->out); free(ctx->tl);
+	ctx->codes = ctx->norm = NULL; ctx->runs = NULL; ctx->wp = NULL;
+	ctx->seq = NULL; ctx->out = NULL; ctx->tl = NULL;
+	ctx->out_len = ctx->out_cap = 0;
+	ctx->tl_len = ctx->tl_cap = 0;
+}
+
+// allocate scratch once, later utterances reuse it
+static int ctx_scratch(TTSContext *ctx)
+{
+	if (ctx->seq) return 1;
+	ctx->codes = (uint32_t *)malloc((size_t)MAX_UTF8_CP * sizeof(uint32_t));
+	ctx->norm  = (uint32_t *)malloc((size_t)(MAX_UTF8_CP / 2) * sizeof(uint32_t));
+	ctx->runs  = (RunEntry *)malloc((size_t)(MAX_UTF8_CP / 2 + 4) * sizeof(RunEntry));
+	ctx->wp    = (WordPhones *)malloc(sizeof(WordPhones));
+	ctx->seq   = seq_new(256);
+	if (!ctx->codes || !ctx->norm || !ctx->runs || !ctx->wp || !ctx->seq) {
+		float *out = ctx->out; int cap = ctx->out_cap;
+		ctx->out = NULL; ctx_free(ctx);
+		ctx->out = out; ctx->out_cap = cap;
+		return 0;
+	}
+	return 1;
+}
+
+// copy voice settings into a worker context
+static void ctx_copy_settings(TTSContext *dst, const TTSContext *src)
+{
+	dst->lang       = src->lang;
+	dst->read_speed = src->read_speed;
+	dst->base_f0    = src->base_f0;
+	dst->whisper    = src->whisper;
+	dst->voice      = src->voice;
+	dst->sample_rate = src->sample_rate;
+}
+
+static inline int ctx_rate(const TTSContext *ctx)
+{
+	return ctx->sample_rate > 0 ? ctx->sample_rate : SAMPLE_RATE;
+}
+
+static uint32_t ctx_rand(TTSContext *ctx)
+{
+	if (!ctx->rng) {
+		uint32_t s = ctx->seed ? ctx->seed : (uint32_t)time(NULL);
+		ctx->rng = rng_mix(s);
+	}
+	return rng_next(&ctx->rng);
+}
+
+// output format of ctx, a dither stream is drawn only when it is used
+static OutFmt ctx_outfmt(TTSContext *ctx)
+{
+	OutFmt f = { ctx->format, ctx->format == TTS_FMT_S16 && ctx->dither, 0 };
+	if (f.dither) f.rng = rng_mix(ctx_rand(ctx)) | 1u;
+	return f;
+}
+
+static int ctx_reserve_out(TTSContext *ctx, int n)
+{
+	if (n <= ctx->out_cap) return 1;
+	float *nb = (float *)realloc(ctx->out, (size_t)n * sizeof(float));
+	if (!nb) return 0;
+	ctx->out = nb; ctx->out_cap = n;
+	return 1;
+}
+
+// samples a sequence renders to, capped at 90 seconds
+static int sequence_length(const TTSSeq *s)
+{
+	long long total = 0;
+	for (int i = 0; i < s->seqLen; i++) total += (long long)s->totalSamples[i];
+	long long cap = 90ll * (s->sample_rate > 0 ? s->sample_rate : SAMPLE_RATE);
+	if (total > cap) total = cap;
+	return (int)total;
+}
+
+// phone timeline of the last utterance a context built or rendered, for
+// lip sync against the playback position. frames of the same phone merge
+// into one run; its type is that of the loudest frame, its flags those of
+// all of them. a closing run of code 0 starts where the audio ends
+static int timeline_reserve(TTSContext *ctx, int n)
+{
+	if (n <= ctx->tl_cap) return 1;
+	int cap = ctx->tl_cap ? ctx->tl_cap : 64;
+	while (cap < n) cap *= 2;
+	TimelineRun *nb = (TimelineRun *)realloc(ctx->tl, (size_t)cap * sizeof(TimelineRun));
+	if (!nb) return 0;
+	ctx->tl = nb; ctx->tl_cap = cap;
+	return 1;
+}
+
+static void timeline_build(TTSContext *ctx, const TTSSeq *s)
+{
+	ctx->tl_len = 0;
+	if (s->seqLen <= 0 || !timeline_reserve(ctx, s->seqLen + 1)) return;
+	int total = sequence_length(s);
+	int at = 0;
+	TimelineRun *r = NULL;
+	for (int i = 0; i < s->seqLen && at < total; i++) {
+		if (!r || r->code != s->code[i]) {
+			r = &ctx->tl[ctx->tl_len++];
+			r->start = at;
+			r->code  = s->code[i];
+			r->kind  = s->type[i] | s->flags[i] << 8;
+			r->amp   = s->amplitude[i];
+		} else {
+			if (s->amplitude[i] > r->amp) {
+				r->kind = (r->kind & ~0xFF) | s->type[i];
+				r->amp  = s->amplitude[i];
+			}
+			r->kind |= s->flags[i] << 8;
+		}
+		at += s->totalSamples[i];
+	}
+	r = &ctx->tl[ctx->tl_len++];
+	r->start = total;
+	r->code  = 0;
+	r->kind  = vtype_silence;
+	r->amp   = 0.0f;
+}
+
+// text front end expansion g2p prosody and frame building into seq
+// returns frame count
+static int build_sequence(TTSContext *ctx, const char *txt, TTSSeq *seq)
+{
+	seq_clear(seq);
+	ctx->builds++;
+	ctx->tl_len = 0;
+	seq->sample_rate = ctx_rate(ctx);
+	if (!txt || !ctx_scratch(ctx)) return 0;
+	seq->rng = rng_mix(ctx_rand(ctx));
+
+	LangID eff = (ctx->lang == LANG_AUTO) ? detect_lang(txt) : ctx->lang;
+	VoiceXform xf;
+	seq->xf = ctx_xform(ctx, &xf);
+
+	if (eff == LANG_EN) {
+		char *exp = en_expand_input(txt);
+		const char *use = exp ? exp : txt;
+		int ni = utf8_to_cp(use, ctx->codes, MAX_UTF8_CP);
+		if (exp) free(exp);
+		if (ni > 0) prepare_sequence_en(ctx, ctx->codes, ni, seq);
+	} else {
+		char *exp = ru_expand_input(txt);
+		const char *use = exp ? exp : txt;
+		int half = MAX_UTF8_CP / 2;
+		int ncp = utf8_to_cp(use, ctx->codes, half);
+		if (exp) free(exp);
+		int ni = 0;
+		for (int i = 0; i < ncp && ni < half; i++) ctx->norm[ni++] = ru_normalize_upper(ctx->codes[i]);
+		if (ni > 0) prepare_sequence_ru(ctx, ctx->norm, ni, seq);
+	}
+
+	seq->xf = NULL;
+	timeline_build(ctx, seq);
+	return seq->seqLen;
+}
+
+// render up to max samples of s into dst without post-processing
+static int render_raw(TTSSeq *s, float *dst, int max)
+{
+	reset_seq(s);
+	unsigned fpmode = kn_denormals_off();
+	int idx = 0;
+	while (s->currentIndex < s->seqLen && idx < max)
+		dst[idx++] = generate_sample(s);
+	kn_denormals_restore(fpmode);
+	return idx;
+}
+
+// render up to max samples of s into dst and post-process them
+static int render_frames(TTSSeq *s, float *dst, int max)
+{
+	int idx = render_raw(s, dst, max);
+	postprocess(dst, idx, s->sample_rate);
+	return idx;
+}
+
+// render a built sequence into the context output buffer, in the
+// context's output format (converted in place)
+static int render_sequence(TTSContext *ctx, TTSSeq *s)
+{
+	ctx->out_len = 0;
+	int total = sequence_length(s);
+	if (total <= 0 || !ctx_reserve_out(ctx, total)) return 0;
+	s->rng = rng_mix(ctx_rand(ctx));
+	int n = render_raw(s, ctx->out, total);
+	OutFmt of = ctx_outfmt(ctx);
+	postprocess_to(ctx->out, n, s->sample_rate, &of, ctx->out);
+	ctx->out_len = n;
+	return ctx->out_len;
+}
 
 // public api
 #ifdef __EMSCRIPTEN__
 EMSCRIPTEN_KEEPALIVE
 #endif
-int tts_sample_rate(void) { return SAMPLE_RATE; }
+int tts_sample_rate(void) { return ctx_rate(&tts_ctx); }
+
+// kernel path synthesis runs on: avx2, sse2 or scalar natively (avx512
+// with TTS_KERNELS=avx512), simd128 or scalar in wasm. then the simd the
+// cpu offers, when known, and whether the build has threads, e.g.
+// "avx2; cpu sse2 avx2 avx512f; threads"
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+const char *tts_get_kernel_info(void)
+{
+	static char info[128];
+	snprintf(info, sizeof(info), "%s%s%s%s%s%s", tts_kernels.name,
+	         tts_kernels.cpu[0] ? "; cpu " : "", tts_kernels.cpu,
+	         tts_kernels.rejected[0] ? "; failed " : "", tts_kernels.rejected,
+#ifdef TTS_HAVE_THREADS
+	         "; threads"
+#else
+	         ""
+#endif
+	         );
+	return info;
+}
+
+#ifndef __EMSCRIPTEN__
+// conformance of every kernel path the cpu runs against tts_kernels_ref,
+// the engine as it rendered before the paths existed. a fixed corpus is
+// built once per voice setting with a fixed seed and rendered through each
+// path with the same noise, then compared sample by sample after
+// postprocess (max and rms deviation) and by spectral envelope per phone
+// type: hann windowed levels at CONF_BANDS log spaced frequencies over
+// 20 ms windows, averaged per type, in db. bands more than 60 db under the
+// loudest of their type are left out. swaps tts_kernels while it runs, so
+// nothing else may render meanwhile. writes a report to out and returns
+// the number of paths that miss a bound
+#define CONF_SEED        0x4B534531u
+#define CONF_SAMPLE_TOL  1e-4     // of full scale, the output peaks at 0.75
+#define CONF_ENV_TOL_DB  0.25
+#define CONF_BANDS       24
+#define CONF_TYPES       vtype_silence
+
+static const char *const conf_corpus[] = {
+	"The quick brown fox jumps over the lazy dog.",
+	"Is it six? Seven, eight: nine hundred and twelve, please!",
+	"She sells sea shells; the thin shaft stopped at the bridge.",
+	"Съешь же ещё этих мягких французских булок, да выпей чаю.",
+	"Широкая электрификация южных губерний даст мощный толчок подъёму сельского хозяйства?"
+};
+
+static const char *const conf_type_names[CONF_TYPES] = { "vowel", "consonant", "fricative", "stop" };
+
+typedef struct {
+	double max_err, sq_err;
+	long   samples;
+	double env[2][CONF_TYPES][CONF_BANDS];   // summed band power, reference and path
+	int    windows[CONF_TYPES];
+} ConfStats;
+
+// render s like render_sequence with noise state rng, recording the phone
+// type of every sample
+static int conf_render(TTSSeq *s, uint32_t rng, float *dst, uint8_t *type, int max)
+{
+	s->rng = rng;
+	reset_seq(s);
+	unsigned fpmode = kn_denormals_off();
+	int n = 0;
+	while (s->currentIndex < s->seqLen && n < max) {
+		dst[n] = generate_sample(s);
+		type[n++] = (uint8_t)s->voice.type;
+	}
+	kn_denormals_restore(fpmode);
+	postprocess(dst, n, s->sample_rate);
+	return n;
+}
+
+// add the band powers of every window whose samples all share a phone type
+static void conf_envelope(double env[CONF_TYPES][CONF_BANDS], int *windows,
+                          const float *x, const uint8_t *type, int n, int sr)
+{
+	int w = sr / 50;
+	double coef[CONF_BANDS];
+	for (int b = 0; b < CONF_BANDS; b++) {
+		double hz = 100.0 * pow(0.45 * sr / 100.0, (double)b / (CONF_BANDS - 1));
+		coef[b] = 2.0 * cos(TWO_PI * hz / sr);
+	}
+	for (int at = 0; at + w <= n; at += w) {
+		int t = type[at];
+		if (t >= CONF_TYPES) continue;
+		int same = 1;
+		for (int i = 1; i < w && same; i++) same = type[at + i] == t;
+		if (!same) continue;
+		if (windows) windows[t]++;
+		for (int b = 0; b < CONF_BANDS; b++) {
+			double s1 = 0.0, s2 = 0.0;   // goertzel
+			for (int i = 0; i < w; i++) {
+				double v = x[at + i] * (0.5 - 0.5 * cos(TWO_PI * i / w)) + coef[b] * s1 - s2;
+				s2 = s1; s1 = v;
+			}
+			env[t][b] += s1 * s1 + s2 * s2 - coef[b] * s1 * s2;
+		}
+	}
+}
+
+// worst band difference in db of one phone type, -1 without windows
+static double conf_env_diff(const ConfStats *st, int t)
+{
+	if (!st->windows[t]) return -1.0;
+	double top = 0.0, worst = 0.0;
+	for (int b = 0; b < CONF_BANDS; b++) if (st->env[0][t][b] > top) top = st->env[0][t][b];
+	for (int b = 0; b < CONF_BANDS; b++) {
+		double r = st->env[0][t][b], p = st->env[1][t][b];
+		if (r < top * 1e-6) continue;
+		double d = fabs(10.0 * log10((p + 1e-30) / (r + 1e-30)));
+		if (!(d <= worst)) worst = d;
+	}
+	return worst;
+}
+
+int tts_conformance(FILE *out)
+{
+	TTSKernels paths[KN_VARIANTS + 1];
+	paths[0] = tts_kernels_ref;
+	int np = 1 + tts_kernels_list(paths + 1);
+	TTSKernels bound = tts_kernels;
+	static ConfStats stats[KN_VARIANTS + 1];
+	memset(stats, 0, sizeof(stats));
+
+	// default voice, whisper, and the child preset for its raised formants
+	static const int settings[][2] = { { 0, 0 }, { 1, 0 }, { 0, 3 } };
+	int nset = (int)(sizeof(settings) / sizeof(settings[0]));
+	int ncorpus = (int)(sizeof(conf_corpus) / sizeof(conf_corpus[0]));
+	TTSContext ctx = { .lang = LANG_AUTO, .read_speed = 1.0, .base_f0 = 120.0, .seed = CONF_SEED };
+	if (!ctx_scratch(&ctx)) { fprintf(out, "out of memory\n"); return KN_VARIANTS; }
+	float *ref = NULL, *got = NULL;
+	uint8_t *type = NULL, *type2 = NULL;
+	int cap = 0, failed = 0, utterances = 0;
+	long total = 0;
+
+	for (int v = 0; v < nset; v++) {
+		ctx.whisper = settings[v][0];
+		ctx.voice   = settings[v][1];
+		for (int c = 0; c < ncorpus; c++) {
+			if (build_sequence(&ctx, conf_corpus[c], ctx.seq) <= 0) continue;
+			TTSSeq *s = ctx.seq;
+			int len = sequence_length(s);
+			if (len > cap) {
+				float *a = (float *)realloc(ref, (size_t)len * sizeof(float));
+				if (a) ref = a;
+				float *b = (float *)realloc(got, (size_t)len * sizeof(float));
+				if (b) got = b;
+				uint8_t *t = (uint8_t *)realloc(type, (size_t)len);
+				if (t) type = t;
+				uint8_t *u = (uint8_t *)realloc(type2, (size_t)len);
+				if (u) type2 = u;
+				if (!a || !b || !t || !u) { fprintf(out, "out of memory\n"); failed = np; goto done; }
+				cap = len;
+			}
+			uint32_t rng = rng_mix(ctx_rand(&ctx));
+			tts_kernels = paths[0];
+			int n = conf_render(s, rng, ref, type, len);
+			utterances++;
+			total += n;
+			for (int p = 1; p < np; p++) {
+				ConfStats *st = &stats[p];
+				tts_kernels = paths[p];
+				int m = conf_render(s, rng, got, type2, len);
+				if (m != n || memcmp(type, type2, (size_t)n)) st->max_err = INFINITY;
+				for (int i = 0; i < n && i < m; i++) {
+					double e = fabs((double)got[i] - ref[i]);
+					if (!(e <= st->max_err)) st->max_err = e;
+					st->sq_err += e * e;
+				}
+				st->samples += n;
+				conf_envelope(st->env[0], st->windows, ref, type, n, s->sample_rate);
+				conf_envelope(st->env[1], NULL, got, type, n < m ? n : m, s->sample_rate);
+			}
+		}
+	}
+
+	fprintf(out, "kernel conformance against the reference: %d utterances, %ld samples, seed %08x\n",
+	        utterances, total, CONF_SEED);
+	fprintf(out, "bounds: sample %.0e, envelope %.2f db, kernels %.0e / %.0e\n",
+	        CONF_SAMPLE_TOL, CONF_ENV_TOL_DB, KN_HARM_TOL, KN_DOT_TOL);
+	for (int p = 1; p < np; p++) {
+		ConfStats *st = &stats[p];
+		KNCheck kc;
+		int ok = kn_conforms(&paths[p], &kc);
+		ok = ok && st->max_err <= CONF_SAMPLE_TOL;
+		fprintf(out, "%-8s kernels %.1e %.1e  max %.2e rms %.2e  env db",
+		        paths[p].name, kc.harm_err, kc.dot_err, st->max_err,
+		        st->samples ? sqrt(st->sq_err / st->samples) : 0.0);
+		for (int t = 0; t < CONF_TYPES; t++) {
+			double d = conf_env_diff(st, t);
+			if (d < 0.0) { fprintf(out, " %s -", conf_type_names[t]); continue; }
+			fprintf(out, " %s %.3f", conf_type_names[t], d);
+			ok = ok && d <= CONF_ENV_TOL_DB;
+		}
+		fprintf(out, "  %s\n", ok ? "ok" : "FAIL");
+		failed += !ok;
+	}
+
+done:
+	tts_kernels = bound;
+	free(ref); free(got); free(type); free(type2);
+	ctx_free(&ctx);
+	return failed;
+}
+
+// render cost of dense speech against text that is mostly pauses, where
+// the filter tails decay towards subnormals (see KN_FLUSH). best of five
+// runs, synthesis and postprocess timed apart, written to out
+static double bench_now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+void tts_bench(FILE *out)
+{
+	static const char *const texts[2][2] = {
+		{ "dense",  "The quick brown fox jumps over the lazy dog while seven sharp scholars study strange structures." },
+		{ "pauses", "One. . . . Two. . . . Three. . . . Four. . . . Five. . . . Six. . . . Seven. . . . Eight." }
+	};
+	TTSContext ctx = { .lang = LANG_AUTO, .read_speed = 1.0, .base_f0 = 120.0, .seed = CONF_SEED };
+	if (!ctx_scratch(&ctx)) { fprintf(out, "out of memory\n"); return; }
+	fprintf(out, "render cost in ns per sample, kernels %s\n", tts_get_kernel_info());
+	for (int k = 0; k < 2; k++) {
+		TTSSeq *s = ctx.seq;
+		build_sequence(&ctx, texts[k][1], s);
+		int total = sequence_length(s);
+		if (total <= 0 || !ctx_reserve_out(&ctx, total)) continue;
+		double synth = 1e30, post = 1e30;
+		int n = 0, zeros = 0;
+		for (int r = 0; r < 5; r++) {
+			s->rng = rng_mix(CONF_SEED);
+			double t0 = bench_now();
+			n = render_raw(s, ctx.out, total);
+			double t1 = bench_now();
+			if (r == 0) for (int i = 0; i < n; i++) zeros += ctx.out[i] == 0.0f;
+			postprocess(ctx.out, n, s->sample_rate);
+			double t2 = bench_now();
+			if (t1 - t0 < synth) synth = t1 - t0;
+			if (t2 - t1 < post) post = t2 - t1;
+		}
+		if (n <= 0) continue;
+		fprintf(out, "%-7s %7d samples, %3d%% silent  synth %6.1f  post %6.1f\n", texts[k][0], n,
+		        100 * zeros / n, synth * 1e9 / n, post * 1e9 / n);
+	}
+	ctx_free(&ctx);
+}
+#endif
+
+// render at sr (8000 .. 96000) from the next build on, e.g. the audio
+// device's rate so nothing resamples behind the engine. filters, burst
+// and pause lengths follow the rate; prepared, compiled and streamed
+// utterances keep the rate they were built at. returns the rate in use
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_set_sample_rate(int sr)
+{
+	if (sr < SAMPLE_RATE_MIN) sr = SAMPLE_RATE_MIN;
+	if (sr > SAMPLE_RATE_MAX) sr = SAMPLE_RATE_MAX;
+	tts_ctx.sample_rate = sr;
+	return sr;
+}
 
 #ifdef __EMSCRIPTEN__
 EMSCRIPTEN_KEEPALIVE
 #endif
 void tts_set_language(int lang)
 {
-	if (lang == 1)      current_lang = LANG_EN;
-	else if (lang == 2) current_lang = LANG_AUTO;
-	else                current_lang = LANG_RU;
+	if (lang == 1)      tts_ctx.lang = LANG_EN;
+	else if (lang == 2) tts_ctx.lang = LANG_AUTO;
+	else                tts_ctx.lang = LANG_RU;
 }
 
 #ifdef __EMSCRIPTEN__
 EMSCRIPTEN_KEEPALIVE
 #endif
 void tts_set_speed(double spd)
-{ if (spd < 0.1) spd = 0.1; if (spd > 8.0) spd = 8.0; tts_read_speed = spd; }
+{ if (spd < 0.1) spd = 0.1; if (spd > 8.0) spd = 8.0; tts_ctx.read_speed = spd; }
 
 #ifdef __EMSCRIPTEN__
 EMSCRIPTEN_KEEPALIVE
 #endif
 void tts_set_pitch(double hz)
-{ if (hz < 50.0) hz = 50.0; if (hz > 300.0) hz = 300.0; prosody_base_f0 = hz; }
+{ if (hz < 50.0) hz = 50.0; if (hz > 300.0) hz = 300.0; tts_ctx.base_f0 = hz; }
+
+// fix the noise and pitch jitter seed for reproducible output, 0 seeds from the clock
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+void tts_set_seed(unsigned int seed)
+{ tts_ctx.seed = seed; tts_ctx.rng = 0; }
+
+// sample format of tts_speak, tts_render_into, tts_render_compiled and the
+// stream: 0 float, 1 int16 (dither adds tpdf noise before rounding),
+// 2 mu-law. tts_get_buf() then holds samples of that format. batch,
+// pipelined, incremental and job output stays float
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+void tts_set_output_format(int format, int dither)
+{
+	tts_ctx.format = (format == TTS_FMT_S16 || format == TTS_FMT_ULAW) ? format : TTS_FMT_F32;
+	tts_ctx.dither = dither ? 1 : 0;
+}
+
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_sample_bytes(void) { return fmt_bytes(tts_ctx.format); }
 
 #ifdef __EMSCRIPTEN__
 EMSCRIPTEN_KEEPALIVE
 #endif
 int tts_speak(const char *txt)
 {
-	if (!txt) return 0;
-	static int seeded = 0;
-	if (!seeded) { srand((unsigned int)time(NULL)); seeded = 1; }
+	tts_ctx.out_len = 0;
+	if (!txt || !ctx_scratch(&tts_ctx)) return 0;
+	if (build_sequence(&tts_ctx, txt, tts_ctx.seq) <= 0) return 0;
+	return render_sequence(&tts_ctx, tts_ctx.seq);
+}
 
-	LangID eff = (current_lang == LANG_AUTO) ? detect_lang(txt) : current_lang;
-	TTSSeq *s  = NULL;
+// rendering into caller owned memory
+// tts_prepare() runs the front end and returns the exact sample count,
+// tts_render_into() then renders that utterance straight into dst
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_prepare(const char *txt)
+{
+	if (!txt || !ctx_scratch(&tts_ctx)) return 0;
+	if (build_sequence(&tts_ctx, txt, tts_ctx.seq) <= 0) return 0;
+	return sequence_length(tts_ctx.seq);
+}
 
-	if (eff == LANG_EN) {
-		char *exp = en_expand_input(txt);
-		const char *use = exp ? exp : txt;
-		uint32_t *codes = (uint32_t *)malloc((size_t)MAX_UTF8_CP * sizeof(uint32_t));
-		if (!codes) { if (exp) free(exp); return 0; }
-		int ni = utf8_to_cp(use, codes, MAX_UTF8_CP);
-		if (exp) free(exp);
-		if (ni > 0) s = prepare_sequence_en(codes, ni);
-		free(codes);
-	} else {
-		char *exp = ru_expand_input(txt);
-		const char *use = exp ? exp : txt;
-		int half = MAX_UTF8_CP / 2;
-		uint32_t *codes = (uint32_t *)malloc((size_t)half * sizeof(uint32_t));
-		uint32_t *norm  = (uint32_t *)malloc((size_t)half * sizeof(uint32_t));
-		if (!codes || !norm) { free(codes); free(norm); if (exp) free(exp); return 0; }
-		int ncp = utf8_to_cp(use, codes, half);
-		if (exp) free(exp);
-		int ni = 0;
-		for (int i = 0; i < ncp && ni < half; i++) norm[ni++] = ru_normalize_upper(codes[i]);
-		free(codes);
-		if (ni > 0) s = prepare_sequence_ru(norm, ni);
-		free(norm);
-	}
+// dst holds cap samples of the output format. compact formats render
+// through the context buffer first. returns samples written, 0 if nothing
+// is prepared or cap is too small
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_render_into(void *dst, int cap)
+{
+	TTSSeq *s = tts_ctx.seq;
+	if (!dst || !s || s->seqLen <= 0) return 0;
+	int total = sequence_length(s);
+	if (total <= 0 || total > cap) return 0;
+	s->rng = rng_mix(ctx_rand(&tts_ctx));
+	if (tts_ctx.format == TTS_FMT_F32) return render_frames(s, (float *)dst, total);
+	if (!ctx_reserve_out(&tts_ctx, total)) return 0;
+	int n = render_raw(s, tts_ctx.out, total);
+	OutFmt of = ctx_outfmt(&tts_ctx);
+	postprocess_to(tts_ctx.out, n, s->sample_rate, &of, dst);
+	tts_ctx.out_len = 0;
+	return n;
+}
 
-	if (!s) return 0;
+// take ownership of the last output buffer, tts_get_len() samples long.
+// it stays valid across later calls until passed to tts_release_buf,
+// the next utterance renders into a fresh buffer
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+float *tts_detach_buf(void)
+{
+	float *b = tts_ctx.out;
+	tts_ctx.out = NULL;
+	tts_ctx.out_len = tts_ctx.out_cap = 0;
+	return b;
+}
 
-	if (whisper_mode)
-		whisper_transform_seq(s);
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+void tts_release_buf(float *buf) { free(buf); }
+
+// streaming render
+// the utterance comes out block by block so playback can start before it
+// is fully rendered. the peak normalisation of postprocess() is replaced by
+// a gain that follows the peak of a lookahead of raw samples; it only falls,
+// and is exact for utterances shorter than the lookahead.
+#define STREAM_LOOKAHEAD 8192
+
+// seek index
+// frame starts are prefix sums of totalSamples. a second table holds the
+// frame under every SEEK_STEP-th sample, so a lookup is one table read and
+// a scan over the few frames inside one step, wherever the sample lies
+#define SEEK_SHIFT 10
+#define SEEK_STEP  (1 << SEEK_SHIFT)
 
-	long long total = 0;
-	for (int i = 0; i < s->seqLen; i++) total += (long long)s->seq[i].totalSamples;
-	if (total <= 0) { free_tts(s); return 0; }
-	if (total > SAMPLE_RATE * 90) total = SAMPLE_RATE * 90;
+typedef struct {
+	int32_t *start;   // frames + 1 offsets, the last is the end of the last frame
+	int32_t *step;    // frame holding sample k << SEEK_SHIFT
+	int      frames, steps;
+	int      start_cap, step_cap;
+} SeekIndex;
 
-	if (tts_output_buf) { free(tts_output_buf); tts_output_buf = NULL; tts_output_len = 0; }
-	tts_output_buf = (float *)malloc((size_t)total * sizeof(float));
-	if (!tts_output_buf) { free_tts(s); return 0; }
+static int seek_grow(int32_t **a, int *cap, int n)
+{
+	if (n <= *cap) return 1;
+	int32_t *nb = (int32_t *)realloc(*a, (size_t)n * sizeof(int32_t));
+	if (!nb) return 0;
+	*a = nb; *cap = n;
+	return 1;
+}
 
-	reset_seq(s);
-	int idx = 0;
-	while (s->currentIndex < s->seqLen && idx < (int)total)
-		tts_output_buf[idx++] = generate_sample(s);
-	free_tts(s);
+// index the first total samples of s, returns 0 when out of memory
+static int seek_build(SeekIndex *ix, const TTSSeq *s, int total)
+{
+	int steps = (total >> SEEK_SHIFT) + 1;
+	ix->frames = ix->steps = 0;
+	if (!seek_grow(&ix->start, &ix->start_cap, s->seqLen + 1) ||
+		!seek_grow(&ix->step, &ix->step_cap, steps)) return 0;
+	long long at = 0;
+	int k = 0;
+	for (int i = 0; i < s->seqLen; i++) {
+		long long end = at + s->totalSamples[i];
+		ix->start[i] = (int32_t)(at < INT32_MAX ? at : INT32_MAX);
+		while (k < steps && ((long long)k << SEEK_SHIFT) < end) ix->step[k++] = i;
+		at = end;
+	}
+	ix->start[s->seqLen] = (int32_t)(at < INT32_MAX ? at : INT32_MAX);
+	while (k < steps) ix->step[k++] = s->seqLen;
+	ix->frames = s->seqLen;
+	ix->steps  = steps;
+	return 1;
+}
+
+// frame holding sample, frames when it lies past the last one
+static int seek_frame(const SeekIndex *ix, int sample)
+{
+	int k = sample >> SEEK_SHIFT;
+	if (k >= ix->steps) return ix->frames;
+	int i = ix->step[k];
+	while (i < ix->frames && ix->start[i + 1] <= sample) i++;
+	return i;
+}
+
+static void seek_free(SeekIndex *ix)
+{
+	free(ix->start); free(ix->step);
+	memset(ix, 0, sizeof(*ix));
+}
 
-	tts_output_len = idx;
-	postprocess(tts_output_buf, tts_output_len, SAMPLE_RATE);
-	return tts_output_len;
+typedef struct {
+	PostFX fx;
+	float  look[STREAM_LOOKAHEAD];  // raw samples not yet emitted
+	int    head, count;
+	float  peak, gain;
+	int    total, generated, emitted;
+	int    active, started;
+	TTSSeq         *seq;            // sequence being rendered
+	const uint32_t *builds;         // owner's build counter when seq is shared
+	uint32_t        build;          // its value when the stream began
+	OutFmt          fmt;            // owner's output format when it began
+	SeekIndex       seek;           // frame offsets of seq, built when it began
+	int             seekable;       // seek holds seq's current frames
+} TTSStream;
+
+static TTSStream tts_stream;
+
+// build the utterance with ctx and start streaming it, returns total sample
+// count. seq NULL uses the context sequence, any other build on ctx then
+// ends the stream; with its own seq the stream can outlive ctx's next use
+static int stream_begin(TTSContext *ctx, TTSStream *st, TTSSeq *seq, const char *txt)
+{
+	st->active = 0;
+	if (!txt || !ctx_scratch(ctx)) return 0;
+	TTSSeq *s = seq ? seq : ctx->seq;
+	if (build_sequence(ctx, txt, s) <= 0) return 0;
+	int total = sequence_length(s);
+	if (total <= 0) return 0;
+
+	s->rng = rng_mix(ctx_rand(ctx));
+	reset_seq(s);
+	postfx_init(&st->fx, s->sample_rate);
+	st->head = st->count = 0;
+	st->peak = 0.0f; st->gain = 1.0f;
+	st->total = total;
+	st->generated = st->emitted = 0;
+	st->started = 0;
+	st->seq    = s;
+	st->builds = s == ctx->seq ? &ctx->builds : NULL;
+	st->build  = ctx->builds;
+	st->fmt    = ctx_outfmt(ctx);
+	st->seekable = seek_build(&st->seek, s, total);
+	st->active = 1;
+	return total;
 }
 
+// render the next up to n samples into dst in the stream's format,
+// returns 0 once the stream ends
+static int stream_read(TTSStream *st, void *dst, int n)
+{
+	TTSSeq *s = st->seq;
+	if (!st->active || !dst || n <= 0) return 0;
+	if (st->builds && st->build != *st->builds) { st->active = 0; return 0; }
+
+	unsigned fpmode = kn_denormals_off();
+	// keep the lookahead full so the gain sees peaks before they play
+	while (st->count < STREAM_LOOKAHEAD && st->generated < st->total && s->currentIndex < s->seqLen) {
+		float v = generate_sample(s);
+		st->look[(st->head + st->count) % STREAM_LOOKAHEAD] = v;
+		st->count++; st->generated++;
+		if (fabsf(v) > st->peak) st->peak = fabsf(v);
+	}
+
+	float target = st->peak > 1e-6f ? 0.75f / st->peak : 1.0f;
+	if (!st->started) { st->gain = target; st->started = 1; }
+
+	int m = n < st->count ? n : st->count;
+	for (int i = 0; i < m; i++) {
+		// glide down over ~60 ms, well inside the lookahead
+		if (st->gain > target) st->gain = target + (st->gain - target) * 0.999f;
+		fmt_store(&st->fmt, dst, i, postfx_proc(&st->fx, st->look[st->head] * st->gain));
+		st->head = (st->head + 1) % STREAM_LOOKAHEAD;
+	}
+	kn_denormals_restore(fpmode);
+	st->count   -= m;
+	st->emitted += m;
+	if (st->count == 0 && (st->generated >= st->total || s->currentIndex >= s->seqLen)) st->active = 0;
+	return m;
+}
+
+// continue the stream at sample. frames restart their voice state, so
+// only the part of the frame holding sample that lies before it is
+// rendered and dropped; the cost does not grow with the position. the
+// post filters restart, the gain keeps the peak seen so far, and noise
+// differs from a straight render. a stream that ran out can be sought
+// back into until its sequence is rebuilt. returns the new position, or
+// -1 when the stream cannot seek
+static int stream_seek(TTSStream *st, int sample)
+{
+	TTSSeq *s = st->seq;
+	if (!s || !st->seekable) return -1;
+	if (st->builds && st->build != *st->builds) { st->active = 0; return -1; }
+	if (sample < 0) sample = 0;
+	if (sample > st->total) sample = st->total;
+
+	st->head = st->count = 0;
+	int i = seek_frame(&st->seek, sample);
+	if (sample >= st->total || i >= s->seqLen) {
+		st->generated = st->emitted = st->total;
+		st->active = 0;
+		return st->total;
+	}
+	s->currentIndex = i;
+	load_frame(&s->voice, s, i);
+	unsigned fpmode = kn_denormals_off();
+	for (int n = sample - st->seek.start[i]; n > 0; n--) generate_sample(s);
+	kn_denormals_restore(fpmode);
+	postfx_init(&st->fx, s->sample_rate);
+	st->generated = st->emitted = sample;
+	st->active = 1;
+	return sample;
+}
+
+// release the seek index of a stream that is not used again
+static void stream_free(TTSStream *st)
+{
+	seek_free(&st->seek);
+	st->seekable = 0;
+	st->active   = 0;
+}
+
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_stream_begin(const char *txt) { return stream_begin(&tts_ctx, &tts_stream, NULL, txt); }
+
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_stream_read(void *dst, int n) { return stream_read(&tts_stream, dst, n); }
+
+// jump the stream to sample of its utterance, see stream_seek
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_stream_seek(int sample) { return stream_seek(&tts_stream, sample); }
+
+// drop the stream and its seek index; tts_stream_begin starts a new one
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+void tts_stream_end(void) { stream_free(&tts_stream); }
+
+// asynchronous jobs
+// a job renders in bounded steps so the caller can interleave other work,
+// read progress and cancel. cancellation is checked at every frame and
+// step boundary and frees the job buffers straight away. natively a job
+// can also run on its own thread with tts_job_run_async.
+#define TTS_MAX_JOBS 8
+
+enum { TTS_JOB_RUNNING = 1, TTS_JOB_DONE = 2, TTS_JOB_CANCELLED = 3, TTS_JOB_FAILED = 4 };
+
+typedef struct {
+	int32_t state;
+	int32_t frames_done, frames_total;
+	int32_t samples_done, samples_total;
+} TTSJobProgress;
+
+typedef void (*TTSJobCallback)(int id, const TTSJobProgress *p, void *user);
+
+typedef struct {
+	int            id;        // 0 marks a free slot
+	TTSJobProgress prog;
+	int            cancel;
+	int            phase;     // 0 render, 1 post-process
+	TTSSeq        *seq;
+	float         *out;
+	int            len, post;
+	float          peak, gain;
+	PostFX         fx;
+#ifdef TTS_HAVE_THREADS
+	int            async;
+	pthread_t      thread;
+	TTSJobCallback cb;
+	void          *user;
+#endif
+} TTSJob;
+
+static TTSJob tts_jobs[TTS_MAX_JOBS];
+static int    tts_job_next_id = 1;
+
+static TTSJob *job_find(int id)
+{
+	if (id <= 0) return NULL;
+	for (int i = 0; i < TTS_MAX_JOBS; i++)
+		if (tts_jobs[i].id == id) return &tts_jobs[i];
+	return NULL;
+}
+
+static inline int job_cancelled(TTSJob *j)
+{
+#ifdef TTS_HAVE_THREADS
+	return __atomic_load_n(&j->cancel, __ATOMIC_ACQUIRE);
+#else
+	return j->cancel;
+#endif
+}
+
+static inline int job_state(TTSJob *j)
+{
+#ifdef TTS_HAVE_THREADS
+	return __atomic_load_n(&j->prog.state, __ATOMIC_ACQUIRE);
+#else
+	return j->prog.state;
+#endif
+}
+
+static inline void job_set(int32_t *field, int32_t v)
+{
+#ifdef TTS_HAVE_THREADS
+	__atomic_store_n(field, v, __ATOMIC_RELEASE);
+#else
+	*field = v;
+#endif
+}
+
+static void job_release(TTSJob *j)
+{
+	free_tts(j->seq); j->seq = NULL;
+	free(j->out);     j->out = NULL;
+}
+
+static int job_finish(TTSJob *j, int state)
+{
+	if (state != TTS_JOB_DONE) job_release(j);
+	else { free_tts(j->seq); j->seq = NULL; }
+	job_set(&j->prog.state, state);
+	return state;
+}
+
+// render or post-process up to budget samples, returns the job state
+static int job_step(TTSJob *j, int budget)
+{
+	if (j->prog.state != TTS_JOB_RUNNING) return j->prog.state;
+	if (job_cancelled(j)) return job_finish(j, TTS_JOB_CANCELLED);
+	if (budget <= 0) budget = 4096;
+
+	if (j->phase == 0) {
+		TTSSeq *s = j->seq;
+		int total = j->prog.samples_total;
+		int done  = j->prog.samples_done;
+		int end   = (total - done > budget) ? done + budget : total;
+		int frame = s->currentIndex, cancelled = 0;
+		unsigned fpmode = kn_denormals_off();
+		while (done < end && s->currentIndex < s->seqLen) {
+			float v = generate_sample(s);
+			j->out[done++] = v;
+			if (fabsf(v) > j->peak) j->peak = fabsf(v);
+			if (s->currentIndex != frame) {
+				frame = s->currentIndex;
+				job_set(&j->prog.frames_done, frame);
+				if ((cancelled = job_cancelled(j))) break;
+			}
+		}
+		kn_denormals_restore(fpmode);
+		if (cancelled) return job_finish(j, TTS_JOB_CANCELLED);
+		job_set(&j->prog.samples_done, done);
+		if (done >= total || s->currentIndex >= s->seqLen) {
+			// same normalisation and chain as postprocess()
+			j->len   = done;
+			j->gain  = j->peak > 1e-6f ? 0.75f / j->peak : 1.0f;
+			j->post  = 0;
+			j->phase = 1;
+			postfx_init(&j->fx, s->sample_rate);
+		}
+		return TTS_JOB_RUNNING;
+	}
+
+	int end = (j->len - j->post > budget) ? j->post + budget : j->len;
+	unsigned fpmode = kn_denormals_off();
+	for (int i = j->post; i < end; i++) j->out[i] = postfx_proc(&j->fx, j->out[i] * j->gain);
+	kn_denormals_restore(fpmode);
+	j->post = end;
+	if (j->post >= j->len) return job_finish(j, TTS_JOB_DONE);
+	return TTS_JOB_RUNNING;
+}
+
+// run the text front end and queue txt for rendering, returns a job id or 0.
+// the output matches tts_speak() for the same seed
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_job_start(const char *txt)
+{
+	TTSJob *j = NULL;
+	for (int i = 0; i < TTS_MAX_JOBS; i++)
+		if (tts_jobs[i].id == 0) { j = &tts_jobs[i]; break; }
+	if (!txt || !j || !ctx_scratch(&tts_ctx)) return 0;
+
+	memset(j, 0, sizeof(*j));
+	j->seq = seq_new(256);
+	if (!j->seq) return 0;
+	if (build_sequence(&tts_ctx, txt, j->seq) <= 0) { free_tts(j->seq); j->seq = NULL; return 0; }
+	int total = sequence_length(j->seq);
+	j->out = total > 0 ? (float *)malloc((size_t)total * sizeof(float)) : NULL;
+	if (!j->out) { job_release(j); return 0; }
+
+	j->seq->rng = rng_mix(ctx_rand(&tts_ctx));
+	reset_seq(j->seq);
+	j->prog.frames_total  = j->seq->seqLen;
+	j->prog.samples_total = total;
+	j->prog.state = TTS_JOB_RUNNING;
+	j->id = tts_job_next_id++;
+	if (tts_job_next_id <= 0) tts_job_next_id = 1;
+	return j->id;
+}
+
+// advance a job by up to budget samples on the calling thread, returns its state
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_job_step(int id, int budget)
+{
+	TTSJob *j = job_find(id);
+	if (!j) return 0;
+#ifdef TTS_HAVE_THREADS
+	if (j->async) return job_state(j);
+#endif
+	return job_step(j, budget);
+}
+
+// progress snapshot, five int32: state frames_done frames_total samples_done samples_total
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+const TTSJobProgress *tts_job_progress(int id)
+{
+	TTSJob *j = job_find(id);
+	return j ? &j->prog : NULL;
+}
+
+// ask a job to stop, it is released at its next frame boundary at the latest
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+void tts_job_cancel(int id)
+{
+	TTSJob *j = job_find(id);
+	if (!j) return;
+#ifdef TTS_HAVE_THREADS
+	__atomic_store_n(&j->cancel, 1, __ATOMIC_RELEASE);
+	if (j->async) return;
+#else
+	j->cancel = 1;
+#endif
+	if (j->prog.state == TTS_JOB_RUNNING) job_finish(j, TTS_JOB_CANCELLED);
+}
+
+// take ownership of a finished job's samples (free with tts_release_buf)
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+float *tts_job_take(int id, int *len)
+{
+	TTSJob *j = job_find(id);
+	if (len) *len = 0;
+	if (!j || job_state(j) != TTS_JOB_DONE) return NULL;
+	float *b = j->out;
+	j->out = NULL;
+	if (len) *len = j->len;
+	return b;
+}
+
+// release a job slot, cancelling the job first if it still runs
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+void tts_job_free(int id)
+{
+	TTSJob *j = job_find(id);
+	if (!j) return;
+	tts_job_cancel(id);
+#ifdef TTS_HAVE_THREADS
+	if (j->async) pthread_join(j->thread, NULL);
+#endif
+	job_release(j);
+	j->id = 0;
+}
+
+#ifdef TTS_HAVE_THREADS
+static void *job_thread(void *p)
+{
+	TTSJob *j = (TTSJob *)p;
+	int st;
+	do {
+		st = job_step(j, 4096);
+		if (j->cb) {
+			TTSJobProgress snap = j->prog;
+			snap.state = st;
+			j->cb(j->id, &snap, j->user);
+		}
+	} while (st == TTS_JOB_RUNNING);
+	return NULL;
+}
+
+// render a job on its own thread, cb (may be NULL) runs on that thread
+// after every step. poll with tts_job_progress, tts_job_free joins it
+int tts_job_run_async(int id, TTSJobCallback cb, void *user)
+{
+	TTSJob *j = job_find(id);
+	if (!j || j->async || j->prog.state != TTS_JOB_RUNNING) return 0;
+	j->cb = cb; j->user = user;
+	j->async = 1;
+	if (pthread_create(&j->thread, NULL, job_thread, j) != 0) { j->async = 0; return 0; }
+	return 1;
+}
+#endif
+
+// batch synthesis
+// every item lands in one contiguous region of the output buffer,
+// item i spans [offsets[i], offsets[i+1]). items are built in one pass,
+// then rendered in a second pass once their offsets are known.
+typedef struct {
+	const char **texts;
+	int          n;
+	uint32_t     base_seed;
+	TTSSeq     **seqs;
+	int         *offsets;
+	float       *out;
+	int          phase;     // 0 build, 1 render
+	int          next;      // next unclaimed item
+} BatchJob;
+
+static TTSContext batch_workers[TTS_MAX_WORKERS];
+static TTSSeq   **batch_seqs    = NULL;
+static int       *batch_offsets = NULL;
+static int        batch_cap     = 0;
+static int        batch_count   = 0;
+
+static int batch_claim(BatchJob *job)
+{
+#ifdef TTS_HAVE_THREADS
+	return __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+#else
+	return job->next++;
+#endif
+}
+
+// per-item seeds keep output independent of worker count and scheduling
+static inline uint32_t item_seed(uint32_t base, int i)
+{
+	return rng_mix(base + (uint32_t)i * 0x9E3779B9u);
+}
+
+static inline uint32_t item_render_seed(uint32_t base, int i)
+{
+	return rng_mix(item_seed(base, i) ^ 0x5BD1E995u);
+}
+
+static void batch_run(BatchJob *job, TTSContext *ctx)
+{
+	for (int i = batch_claim(job); i < job->n; i = batch_claim(job)) {
+		TTSSeq *s = job->seqs[i];
+		if (job->phase == 0) {
+			ctx->rng = item_seed(job->base_seed, i);
+			build_sequence(ctx, job->texts[i], s);
+		} else {
+			int off = job->offsets[i], len = job->offsets[i + 1] - off;
+			if (len <= 0) continue;
+			s->rng = item_render_seed(job->base_seed, i);
+			render_frames(s, job->out + off, len);
+		}
+	}
+}
+
+#ifdef TTS_HAVE_THREADS
+typedef struct { BatchJob *job; TTSContext *ctx; } BatchArg;
+
+static void *batch_thread(void *p)
+{
+	BatchArg *a = (BatchArg *)p;
+	kn_denormals_off();   // the thread only renders, it keeps the mode to its end
+	batch_run(a->job, a->ctx);
+	return NULL;
+}
+#endif
+
+// run one phase of the job on up to threads workers, the caller is worker 0
+static void batch_phase(BatchJob *job, int threads)
+{
+	job->next = 0;
+#ifdef TTS_HAVE_THREADS
+	pthread_t tid[TTS_MAX_WORKERS];
+	BatchArg  arg[TTS_MAX_WORKERS];
+	int started = 0;
+	for (int w = 1; w < threads; w++) {
+		arg[w].job = job; arg[w].ctx = &batch_workers[w];
+		if (pthread_create(&tid[w], NULL, batch_thread, &arg[w]) != 0) break;
+		started = w;
+	}
+	batch_run(job, &batch_workers[0]);
+	for (int w = 1; w <= started; w++) pthread_join(tid[w], NULL);
+#else
+	(void)threads;
+	batch_run(job, &batch_workers[0]);
+#endif
+}
+
+// synthesise n texts into one output region
+// threads <= 1 renders on the calling thread, returns total samples
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_speak_batch(const char **texts, int n, int threads)
+{
+	tts_ctx.out_len = 0;
+	tts_ctx.tl_len  = 0;   // items build on worker contexts, no timeline for the joined output
+	batch_count = 0;
+	if (!texts || n <= 0) return 0;
+	if (threads < 1) threads = 1;
+	if (threads > TTS_MAX_WORKERS) threads = TTS_MAX_WORKERS;
+	if (threads > n) threads = n;
+
+	if (n > batch_cap) {
+		TTSSeq **ns = (TTSSeq **)realloc(batch_seqs, (size_t)n * sizeof(TTSSeq *));
+		if (!ns) return 0;
+		batch_seqs = ns;
+		int *no = (int *)realloc(batch_offsets, (size_t)(n + 1) * sizeof(int));
+		if (!no) return 0;
+		batch_offsets = no;
+		for (int i = batch_cap; i < n; i++) batch_seqs[i] = NULL;
+		batch_cap = n;
+	}
+	for (int i = 0; i < n; i++) {
+		if (!batch_seqs[i]) batch_seqs[i] = seq_new(256);
+		if (!batch_seqs[i]) return 0;
+	}
+	for (int w = 0; w < threads; w++) {
+		ctx_copy_settings(&batch_workers[w], &tts_ctx);
+		if (!ctx_scratch(&batch_workers[w])) return 0;
+	}
+
+	BatchJob job;
+	memset(&job, 0, sizeof(job));
+	job.texts     = texts;
+	job.n         = n;
+	job.base_seed = ctx_rand(&tts_ctx);
+	job.seqs      = batch_seqs;
+	job.offsets   = batch_offsets;
+
+	// pass 1 front end for every item
+	job.phase = 0;
+	batch_phase(&job, threads);
+
+	long long total = 0;
+	for (int i = 0; i < n; i++) {
+		batch_offsets[i] = (int)total;
+		total += sequence_length(batch_seqs[i]);
+		if (total > 0x7FFFFFFF) return 0;
+	}
+	batch_offsets[n] = (int)total;
+	if (total <= 0 || !ctx_reserve_out(&tts_ctx, (int)total)) return 0;
+
+	// pass 2 render each item into its span
+	job.out   = tts_ctx.out;
+	job.phase = 1;
+	batch_phase(&job, threads);
+
+	batch_count     = n;
+	tts_ctx.out_len = (int)total;
+	return tts_ctx.out_len;
+}
+
+// n + 1 offsets into the output buffer for the last batch
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+const int *tts_get_batch_offsets(void) { return batch_count > 0 ? batch_offsets : NULL; }
+
+// pipelined synthesis
+// the text is cut into sentences. a second thread runs the front end and
+// renders sentence n + 1 while the calling thread post-processes sentence n
+// and places it in the output. the front end alone is a tiny share of the
+// work, so the cut sits before post-processing where the two sides come
+// closest. items travel through a bounded single producer single consumer
+// queue and come back through a second one for reuse. sentences are seeded
+// like batch items, so the output equals tts_speak_batch() over the same
+// sentences whatever the timing.
+#define PIPE_DEPTH 2   // sentences in flight, power of two
+
+typedef struct {
+	void    *slot[PIPE_DEPTH];
+	uint32_t head;   // written by the producer only
+	uint32_t tail;   // written by the consumer only
+#ifdef TTS_HAVE_THREADS
+	pthread_mutex_t lock;    // only for sleeping on an empty queue
+	pthread_cond_t  pushed;
+#endif
+} SPSCQueue;
+
+typedef struct {
+	TTSSeq *seq;
+	float  *pcm;     // raw samples, grows but never shrinks
+	int     cap;
+	int     len;     // -1 when the samples could not be stored
+} PipeItem;
+
+typedef struct {
+	const char *txt;
+	const int  *cuts;   // sentence i spans [cuts[i], cuts[i+1])
+	int         n;
+	uint32_t    base_seed;
+	SPSCQueue   ready, free;
+	char       *text;   // nul terminated copy of the current sentence
+} Pipeline;
+
+static TTSContext pipe_front;
+static PipeItem   pipe_items[PIPE_DEPTH];
+static int       *pipe_cuts     = NULL;
+static int        pipe_cuts_cap = 0;
+static char      *pipe_text     = NULL;
+static int        pipe_text_cap = 0;
+
+static void spsc_init(SPSCQueue *q)
+{
+	memset(q, 0, sizeof(*q));
+#ifdef TTS_HAVE_THREADS
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->pushed, NULL);
+#endif
+}
+
+static void spsc_destroy(SPSCQueue *q)
+{
+#ifdef TTS_HAVE_THREADS
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->pushed);
+#else
+	(void)q;
+#endif
+}
+
+static int spsc_push(SPSCQueue *q, void *v)
+{
+#ifdef TTS_HAVE_THREADS
+	uint32_t h = q->head;
+	if (h - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == PIPE_DEPTH) return 0;
+	q->slot[h & (PIPE_DEPTH - 1)] = v;
+	__atomic_store_n(&q->head, h + 1, __ATOMIC_RELEASE);
+	// a waiter checks the queue under the lock before it sleeps, so the
+	// signal cannot fall between its check and its wait
+	pthread_mutex_lock(&q->lock);
+	pthread_cond_signal(&q->pushed);
+	pthread_mutex_unlock(&q->lock);
+#else
+	if (q->head - q->tail == PIPE_DEPTH) return 0;
+	q->slot[q->head++ & (PIPE_DEPTH - 1)] = v;
+#endif
+	return 1;
+}
+
+static void *spsc_pop(SPSCQueue *q)
+{
+#ifdef TTS_HAVE_THREADS
+	uint32_t t = q->tail;
+	if (__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == t) return NULL;
+	void *v = q->slot[t & (PIPE_DEPTH - 1)];
+	__atomic_store_n(&q->tail, t + 1, __ATOMIC_RELEASE);
+#else
+	if (q->head == q->tail) return NULL;
+	void *v = q->slot[q->tail++ & (PIPE_DEPTH - 1)];
+#endif
+	return v;
+}
+
+// pop, sleeping until the other side pushes when the queue is empty.
+// in wasm pthread builds the condition variable waits with Atomics.wait.
+// without threads the caller only pops what it pushed itself
+static void *spsc_wait_pop(SPSCQueue *q)
+{
+	void *v = spsc_pop(q);
+#ifdef TTS_HAVE_THREADS
+	if (v) return v;
+	pthread_mutex_lock(&q->lock);
+	while (!(v = spsc_pop(q))) pthread_cond_wait(&q->pushed, &q->lock);
+	pthread_mutex_unlock(&q->lock);
+#endif
+	return v;
+}
+
+// bytes of a sentence terminator (. ! ? or the ellipsis character) at s
+static int sentence_end_at(const unsigned char *s)
+{
+	if (s[0] == '.' || s[0] == '!' || s[0] == '?') return 1;
+	if (s[0] == 0xE2 && s[1] == 0x80 && s[2] == 0xA6) return 3;
+	return 0;
+}
+
+// bytes of a closing quote or bracket at s
+static int sentence_closer_at(const unsigned char *s)
+{
+	if (s[0] == '"' || s[0] == '\'' || s[0] == ')' || s[0] == ']') return 1;
+	if (s[0] == 0xE2 && s[1] == 0x80 && (s[2] == 0x9D || s[2] == 0x99)) return 3;
+	return 0;
+}
+
+// cut after terminators and closers followed by whitespace, so 3.14 stays
+// whole. the whitespace stays with the sentence so its pause is kept.
+// sentence i spans [cuts[i], cuts[i+1]), returns the sentence count
+static int split_sentences(const char *txt, int **cuts, int *cap)
+{
+	const unsigned char *u = (const unsigned char *)txt;
+	int len = (int)strlen(txt), n = 0, start = 0, i = 0;
+	while (start < len) {
+		int end = len, k;
+		for (; i < len; i++) {
+			if (!sentence_end_at(u + i)) continue;
+			int j = i;
+			while ((k = sentence_end_at(u + j)) != 0) j += k;
+			while ((k = sentence_closer_at(u + j)) != 0) j += k;
+			i = j - 1;
+			if (j < len && !isspace(u[j])) continue;
+			while (j < len && isspace(u[j])) j++;
+			end = j;
+			break;
+		}
+		if (n + 2 > *cap) {
+			int nc = (n + 2) * 2;
+			int *nb = (int *)realloc(*cuts, (size_t)nc * sizeof(int));
+			if (!nb) return 0;
+			*cuts = nb; *cap = nc;
+		}
+		(*cuts)[n++] = start;
+		start = i = end;
+	}
+	if (n > 0) (*cuts)[n] = len;
+	return n;
+}
+
+// first stage for sentence i: front end and raw samples
+static void pipe_build(Pipeline *p, PipeItem *it, int i)
+{
+	int a = p->cuts[i], len = p->cuts[i + 1] - a;
+	memcpy(p->text, p->txt + a, (size_t)len);
+	p->text[len] = '\0';
+	pipe_front.rng = item_seed(p->base_seed, i);
+	build_sequence(&pipe_front, p->text, it->seq);
+
+	it->len = sequence_length(it->seq);
+	if (it->len <= 0) { it->len = 0; return; }
+	if (it->len > it->cap) {
+		float *nb = (float *)realloc(it->pcm, (size_t)it->len * sizeof(float));
+		if (!nb) { it->len = -1; return; }
+		it->pcm = nb; it->cap = it->len;
+	}
+	it->seq->rng = item_render_seed(p->base_seed, i);
+	it->len = render_raw(it->seq, it->pcm, it->len);
+}
+
+// second stage: post-process behind the previous sentence in the output
+static int pipe_place(PipeItem *it)
+{
+	int len = it->len;
+	if (len < 0) return 0;
+	if (len == 0) return 1;
+	if (tts_ctx.out_len > 0x7FFFFFFF - len) return 0;
+	int need = tts_ctx.out_len + len;
+	if (need > tts_ctx.out_cap && !ctx_reserve_out(&tts_ctx, need > tts_ctx.out_cap * 2 ? need : tts_ctx.out_cap * 2))
+		return 0;
+	float *dst = tts_ctx.out + tts_ctx.out_len;
+	memcpy(dst, it->pcm, (size_t)len * sizeof(float));
+	postprocess(dst, len, it->seq->sample_rate);
+	tts_ctx.out_len += len;
+	return 1;
+}
+
+#ifdef TTS_HAVE_THREADS
+// producer: every sentence in order, only PIPE_DEPTH items exist so the
+// ready queue never overflows
+static void *pipe_thread(void *arg)
+{
+	Pipeline *p = (Pipeline *)arg;
+	for (int i = 0; i < p->n; i++) {
+		PipeItem *it = (PipeItem *)spsc_wait_pop(&p->free);
+		pipe_build(p, it, i);
+		spsc_push(&p->ready, it);
+	}
+	return NULL;
+}
+#endif
+
+// synthesise txt sentence by sentence on two threads, each sentence is
+// normalised on its own. returns total samples
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_speak_pipelined(const char *txt)
+{
+	tts_ctx.out_len = 0;
+	tts_ctx.tl_len  = 0;   // sentences build on pipe_front, no timeline for the joined output
+	if (!txt) return 0;
+	int n = split_sentences(txt, &pipe_cuts, &pipe_cuts_cap);
+	if (n <= 0) return 0;
+
+	int longest = 0;
+	for (int i = 0; i < n; i++)
+		if (pipe_cuts[i + 1] - pipe_cuts[i] > longest) longest = pipe_cuts[i + 1] - pipe_cuts[i];
+	if (longest + 1 > pipe_text_cap) {
+		char *nt = (char *)realloc(pipe_text, (size_t)longest + 1);
+		if (!nt) return 0;
+		pipe_text = nt; pipe_text_cap = longest + 1;
+	}
+	for (int k = 0; k < PIPE_DEPTH; k++) {
+		if (!pipe_items[k].seq) pipe_items[k].seq = seq_new(256);
+		if (!pipe_items[k].seq) return 0;
+	}
+	ctx_copy_settings(&pipe_front, &tts_ctx);
+	if (!ctx_scratch(&pipe_front)) return 0;
+
+	Pipeline p;
+	memset(&p, 0, sizeof(p));
+	p.txt       = txt;
+	p.cuts      = pipe_cuts;
+	p.n         = n;
+	p.base_seed = ctx_rand(&tts_ctx);
+	p.text      = pipe_text;
+	spsc_init(&p.ready);
+	spsc_init(&p.free);
+	for (int k = 0; k < PIPE_DEPTH; k++) spsc_push(&p.free, &pipe_items[k]);
+
+	int ok = 1;
+#ifdef TTS_HAVE_THREADS
+	pthread_t tid;
+	if (pthread_create(&tid, NULL, pipe_thread, &p) == 0) {
+		// drain every sentence even after a failure so the producer can finish
+		for (int i = 0; i < n; i++) {
+			PipeItem *it = (PipeItem *)spsc_wait_pop(&p.ready);
+			if (ok) ok = pipe_place(it);
+			spsc_push(&p.free, it);
+		}
+		pthread_join(tid, NULL);
+		spsc_destroy(&p.ready);
+		spsc_destroy(&p.free);
+		if (!ok) tts_ctx.out_len = 0;
+		return tts_ctx.out_len;
+	}
+#endif
+	// no second thread: same stages, one sentence at a time
+	PipeItem *it = &pipe_items[0];
+	for (int i = 0; i < n && ok; i++) {
+		pipe_build(&p, it, i);
+		ok = pipe_place(it);
+	}
+	spsc_destroy(&p.ready);
+	spsc_destroy(&p.free);
+	if (!ok) tts_ctx.out_len = 0;
+	return tts_ctx.out_len;
+}
+
+// incremental synthesis
+// tts_speak_incremental() keeps an index of the sentences of its last
+// text: a hash of each sentence with the voice settings, and where its
+// samples and timeline runs lie. the next text is cut the same way and
+// looked up sentence by sentence, known sentences copy their samples and
+// runs and only the others run the front end and the renderer. sentences
+// are seeded from their hash and normalised on their own, so a copy equals
+// what a render would give and the cost of a call follows the edit rather
+// than the text. the hash covers the exact bytes, whitespace sets pauses
+typedef struct {
+	uint64_t hash;
+	int      at, bytes;        // text in the render's txt
+	int      off, len;         // samples in the render's pcm
+	int      tl_off, tl_len;   // runs in the render's tl
+} IncSentence;
+
+typedef struct {
+	char        *txt;
+	int          txt_cap;
+	IncSentence *sent;
+	int          n, sent_cap;
+	float       *pcm;
+	int          len, pcm_cap;
+	TimelineRun *tl;           // no closing run
+	int          tl_len, tl_cap;
+} IncRender;
+
+static TTSContext inc_front;
+static IncRender  inc_renders[2];
+static IncRender *inc_last = &inc_renders[0];
+static int       *inc_cuts     = NULL;
+static int        inc_cuts_cap = 0;
+static int       *inc_slots    = NULL;   // open addressing over inc_last, index + 1
+static int        inc_slots_cap = 0;
+static char      *inc_text     = NULL;
+static int        inc_text_cap = 0;
+static int32_t    inc_stats[4];          // sentences, reused, samples rendered, samples
+
+static inline uint64_t fnv1a(uint64_t h, const void *p, size_t n)
+{
+	const uint8_t *b = (const uint8_t *)p;
+	for (size_t i = 0; i < n; i++) h = (h ^ b[i]) * 0x100000001B3ull;
+	return h;
+}
+#define FNV1A_INIT 0xCBF29CE484222325ull
+
+// grow *p to hold n items of size bytes, doubling
+static int inc_grow(void **p, int *cap, int n, size_t size)
+{
+	if (n <= *cap) return 1;
+	int c = *cap ? *cap : 16;
+	while (c < n) c = c > 0x3FFFFFFF ? n : c * 2;
+	void *nb = realloc(*p, (size_t)c * size);
+	if (!nb) return 0;
+	*p = nb; *cap = c;
+	return 1;
+}
+
+// everything a sentence's samples depend on besides its text
+static uint64_t inc_voice_hash(const TTSContext *ctx)
+{
+	int32_t iv[5] = { (int32_t)ctx->lang, ctx->whisper, ctx->voice, ctx_rate(ctx), (int32_t)ctx->seed };
+	double  dv[2] = { ctx->read_speed, ctx->base_f0 };
+	return fnv1a(fnv1a(FNV1A_INIT, iv, sizeof(iv)), dv, sizeof(dv));
+}
+
+static void inc_index(const IncRender *r)
+{
+	int slots = 16;
+	while (slots < r->n * 2) slots *= 2;
+	if (!inc_grow((void **)&inc_slots, &inc_slots_cap, slots, sizeof(int))) {
+		free(inc_slots);   // no index, every sentence renders
+		inc_slots = NULL;
+		inc_slots_cap = 0;
+		return;
+	}
+	memset(inc_slots, 0, (size_t)inc_slots_cap * sizeof(int));
+	for (int i = 0; i < r->n; i++) {
+		int k = (int)(r->sent[i].hash & (uint64_t)(inc_slots_cap - 1));
+		while (inc_slots[k]) k = (k + 1) & (inc_slots_cap - 1);
+		inc_slots[k] = i + 1;
+	}
+}
+
+// sentence of the last render with this hash and text, or NULL
+static const IncSentence *inc_find(uint64_t hash, const char *txt, int bytes)
+{
+	if (!inc_slots_cap) return NULL;
+	for (int k = (int)(hash & (uint64_t)(inc_slots_cap - 1)); inc_slots[k]; k = (k + 1) & (inc_slots_cap - 1)) {
+		const IncSentence *e = &inc_last->sent[inc_slots[k] - 1];
+		if (e->hash == hash && e->bytes == bytes && !memcmp(inc_last->txt + e->at, txt, (size_t)bytes))
+			return e;
+	}
+	return NULL;
+}
+
+// front end and render for a sentence not in the index, behind r's samples
+static int inc_render(IncRender *r, IncSentence *e, uint32_t seed)
+{
+	if (!inc_grow((void **)&inc_text, &inc_text_cap, e->bytes + 1, 1)) return 0;
+	memcpy(inc_text, r->txt + e->at, (size_t)e->bytes);
+	inc_text[e->bytes] = '\0';
+	inc_front.rng = seed;
+	build_sequence(&inc_front, inc_text, inc_front.seq);
+
+	int len = sequence_length(inc_front.seq);
+	if (r->len > 0x7FFFFFFF - len) return 0;
+	if (!inc_grow((void **)&r->pcm, &r->pcm_cap, r->len + len, sizeof(float))) return 0;
+	inc_front.seq->rng = rng_mix(seed ^ 0x5BD1E995u);
+	e->len = len > 0 ? render_raw(inc_front.seq, r->pcm + r->len, len) : 0;
+	postprocess(r->pcm + r->len, e->len, inc_front.seq->sample_rate);
+
+	int runs = inc_front.tl_len > 0 ? inc_front.tl_len - 1 : 0;
+	if (!inc_grow((void **)&r->tl, &r->tl_cap, r->tl_len + runs, sizeof(TimelineRun))) return 0;
+	for (int k = 0; k < runs; k++) {
+		r->tl[r->tl_len + k] = inc_front.tl[k];
+		r->tl[r->tl_len + k].start += e->off;
+	}
+	e->tl_len = runs;
+	return 1;
+}
+
+// a sentence of the last render, copied behind r's samples
+static int inc_copy(IncRender *r, IncSentence *e, const IncSentence *hit)
+{
+	if (r->len > 0x7FFFFFFF - hit->len) return 0;
+	if (!inc_grow((void **)&r->pcm, &r->pcm_cap, r->len + hit->len, sizeof(float)) ||
+	    !inc_grow((void **)&r->tl, &r->tl_cap, r->tl_len + hit->tl_len, sizeof(TimelineRun)))
+		return 0;
+	memcpy(r->pcm + r->len, inc_last->pcm + hit->off, (size_t)hit->len * sizeof(float));
+	for (int k = 0; k < hit->tl_len; k++) {
+		r->tl[r->tl_len + k] = inc_last->tl[hit->tl_off + k];
+		r->tl[r->tl_len + k].start += e->off - hit->off;
+	}
+	e->len    = hit->len;
+	e->tl_len = hit->tl_len;
+	return 1;
+}
+
+// synthesise txt reusing the sentences it shares with the previous call,
+// like tts_speak_pipelined each sentence is normalised on its own. the
+// output is float, the timeline that of the whole text. returns total
+// samples; on failure 0, and the index stays as it was
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_speak_incremental(const char *txt)
+{
+	tts_ctx.out_len = 0;
+	tts_ctx.tl_len  = 0;
+	memset(inc_stats, 0, sizeof(inc_stats));
+	if (!txt) return 0;
+	int n = split_sentences(txt, &inc_cuts, &inc_cuts_cap);
+	if (n <= 0) return 0;
+
+	IncRender *r = inc_last == &inc_renders[0] ? &inc_renders[1] : &inc_renders[0];
+	int bytes = inc_cuts[n];
+	r->n = r->len = r->tl_len = 0;
+	if (!inc_grow((void **)&r->txt, &r->txt_cap, bytes, 1) ||
+	    !inc_grow((void **)&r->sent, &r->sent_cap, n, sizeof(IncSentence)))
+		return 0;
+	memcpy(r->txt, txt, (size_t)bytes);
+	ctx_copy_settings(&inc_front, &tts_ctx);
+	if (!ctx_scratch(&inc_front)) return 0;
+	inc_index(inc_last);
+
+	uint64_t voice = inc_voice_hash(&tts_ctx);
+	uint32_t base  = tts_ctx.seed ? rng_mix(tts_ctx.seed) : ctx_rand(&tts_ctx);
+	for (int i = 0; i < n; i++) {
+		IncSentence *e = &r->sent[r->n++];
+		e->at     = inc_cuts[i];
+		e->bytes  = inc_cuts[i + 1] - e->at;
+		e->hash   = fnv1a(voice, txt + e->at, (size_t)e->bytes);
+		e->off    = r->len;
+		e->tl_off = r->tl_len;
+		const IncSentence *hit = inc_find(e->hash, txt + e->at, e->bytes);
+		if (hit ? !inc_copy(r, e, hit)
+		        : !inc_render(r, e, rng_mix(base ^ (uint32_t)e->hash ^ (uint32_t)(e->hash >> 32))))
+			return 0;
+		r->len    += e->len;
+		r->tl_len += e->tl_len;
+		if (hit) inc_stats[1]++;
+		else     inc_stats[2] += e->len;
+	}
+	inc_stats[0] = n;
+	inc_stats[3] = r->len;
+	inc_last = r;
+
+	if (!ctx_reserve_out(&tts_ctx, r->len) || !timeline_reserve(&tts_ctx, r->tl_len + 1)) return 0;
+	memcpy(tts_ctx.out, r->pcm, (size_t)r->len * sizeof(float));
+	memcpy(tts_ctx.tl, r->tl, (size_t)r->tl_len * sizeof(TimelineRun));
+	TimelineRun *end = &tts_ctx.tl[r->tl_len];
+	end->start = r->len;
+	end->code  = 0;
+	end->kind  = vtype_silence;
+	end->amp   = 0.0f;
+	tts_ctx.tl_len  = r->tl_len + 1;
+	tts_ctx.out_len = r->len;
+	return tts_ctx.out_len;
+}
+
+// what the last tts_speak_incremental did: sentences, sentences reused,
+// samples rendered, samples in total
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+const int32_t *tts_get_incremental_stats(void) { return inc_stats; }
+
+// forget the index, the next tts_speak_incremental renders every sentence
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+void tts_incremental_reset(void)
+{
+	for (int k = 0; k < 2; k++) {
+		IncRender *r = &inc_renders[k];
+		free(r->txt); free(r->sent); free(r->pcm); free(r->tl);
+		memset(r, 0, sizeof(*r));
+	}
+	free(inc_slots);
+	inc_slots = NULL;
+	inc_slots_cap = 0;
+	ctx_free(&inc_front);
+}
+
+// compiled utterances
+static uint8_t *tts_compiled_buf = NULL;
+static int      tts_compiled_len = 0;
+
+// run the front end once and keep the frame sequence as a ksec blob
+// returns blob size in bytes, blob stays valid until the next compile
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_compile(const char *txt)
+{
+	if (!txt || !ctx_scratch(&tts_ctx)) return 0;
+	TTSSeq *s = tts_ctx.seq;
+	if (build_sequence(&tts_ctx, txt, s) <= 0) return 0;
+
+	size_t sz = ksec_size(s->seqLen);
+	if (tts_compiled_buf) { free(tts_compiled_buf); tts_compiled_buf = NULL; tts_compiled_len = 0; }
+	tts_compiled_buf = (uint8_t *)malloc(sz);
+	if (!tts_compiled_buf) return 0;
+	ksec_write(s, tts_compiled_buf);
+
+	tts_compiled_len = (int)sz;
+	return tts_compiled_len;
+}
+
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+uint8_t *tts_get_compiled(void) { return tts_compiled_buf; }
+
+// synthesise straight from a ksec blob, the blob is read in place
+// returns sample count like tts_speak
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_render_compiled(const void *blob, int len)
+{
+	if (!blob || len <= 0) return 0;
+	TTSSeq view;
+	if (!ksec_view(blob, (size_t)len, &view)) return 0;
+	if (view.sample_rate != ctx_rate(&tts_ctx)) return 0;   // compiled for another rate
+	timeline_build(&tts_ctx, &view);
+	return render_sequence(&tts_ctx, &view);
+}
+
+#ifndef __EMSCRIPTEN__
+// map a compiled blob file read only, pair with tts_unmap_compiled
+const void *tts_map_compiled(const char *path, int *len)
+{
+	if (!path || !len) return NULL;
+	*len = 0;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0 || st.st_size > 0x7FFFFFFF) { close(fd); return NULL; }
+	void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return NULL;
+	*len = (int)st.st_size;
+	return p;
+}
+
+void tts_unmap_compiled(const void *blob, int len)
+{
+	if (blob && len > 0) munmap((void *)blob, (size_t)len);
+}
+
+// on-disk pcm cache
+// entries are named by a 64-bit hash of the key: engine version, render
+// kind, voice settings, seed and normalised text. the whole key is stored
+// in the entry too, so a hash collision reads as a miss. a hit is mapped
+// read only and costs no synthesis. entries are written to a temp file and
+// renamed into place, so concurrent writers (threads or processes) never
+// expose a partial entry; equal keys render equal pcm, so whichever rename
+// lands last is as good as the first. past the size budget the least
+// recently used entries go, a hit refreshes its modification time.
+// only seeded output is cached, unseeded output is meant to differ
+#define TTS_CACHE_VERSION 1      // bump whenever rendered output changes
+#define TTS_CACHE_MAGIC   "KSEP"
+#define TTS_CACHE_HEADER  32     // bytes before the samples
+#define TTS_CACHE_STALE   600    // seconds before a leftover temp file is removed
+
+enum {
+	TTS_CACHE_WHOLE  = 0,   // tts_speak: normalised over the whole utterance
+	TTS_CACHE_STREAM = 1    // stream_read in 1024 sample reads, as kse-server sends
+};
+
+// entry layout: header, samples (f32), key bytes
+typedef struct {
+	char     magic[4];
+	uint32_t version;
+	uint32_t sample_rate;
+	uint32_t samples;
+	uint32_t key_len;
+	uint32_t reserved[3];
+} TTSCacheHeader;
+
+static struct {
+	char     *dir;
+	long long max_bytes;
+	long long bytes;      // running estimate, recounted by every eviction pass
+	int       evicting;
+	uint32_t  tmp_seq;
+	uint64_t  hits, misses;
+} tts_cache;
+
+// collapse whitespace runs to one space and trim, in place. the cached
+// paths speak the normalised text, so a hit equals a fresh render
+static int cache_norm(char *txt)
+{
+	int n = 0, gap = 0;
+	for (const char *p = txt; *p; p++) {
+		if (isspace((unsigned char)*p)) { gap = n > 0; continue; }
+		if (gap) { txt[n++] = ' '; gap = 0; }
+		txt[n++] = *p;
+	}
+	txt[n] = '\0';
+	return n;
+}
+
+// key for norm rendered with the voice of ctx, malloced, NULL if unseeded
+static char *cache_key(const TTSContext *ctx, int kind, const char *norm, int *klen)
+{
+	if (!ctx->seed || !norm) return NULL;
+	char head[192];
+	int hn = snprintf(head, sizeof(head), "kse-cache %d ksec %d rate %d kind %d lang %d speed %.9g pitch %.9g whisper %d voice %d seed %u\n",
+	                  TTS_CACHE_VERSION, KSEC_VERSION, ctx_rate(ctx), kind, (int)ctx->lang,
+	                  ctx->read_speed, ctx->base_f0, ctx->whisper, ctx->voice, ctx->seed);
+	size_t tn = strlen(norm);
+	if (hn <= 0 || hn >= (int)sizeof(head) || tn > 0x7FFFFFFF - (size_t)hn) return NULL;
+	char *key = (char *)malloc((size_t)hn + tn);
+	if (!key) return NULL;
+	memcpy(key, head, (size_t)hn);
+	memcpy(key + hn, norm, tn);
+	*klen = hn + (int)tn;
+	return key;
+}
+
+static int cache_path(char *buf, size_t cap, const char *key, int klen)
+{
+	uint64_t h = fnv1a(FNV1A_INIT, key, (size_t)klen);
+	int n = snprintf(buf, cap, "%s/%016llx.pcm", tts_cache.dir, (unsigned long long)h);
+	return n > 0 && (size_t)n < cap;
+}
+
+// map the entry for key, returns its samples or NULL on a miss.
+// pair with cache_release
+static const float *cache_lookup(const char *key, int klen, int *len)
+{
+	char path[4096];
+	*len = 0;
+	if (!tts_cache.dir || !key || !cache_path(path, sizeof(path), key, klen)) return NULL;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) { __atomic_fetch_add(&tts_cache.misses, 1, __ATOMIC_RELAXED); return NULL; }
+	struct stat st;
+	void *p = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > TTS_CACHE_HEADER && st.st_size <= 0x7FFFFFFF)
+		p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	const TTSCacheHeader *h = (const TTSCacheHeader *)p;
+	int ok = p != MAP_FAILED && !memcmp(h->magic, TTS_CACHE_MAGIC, 4) && h->version == TTS_CACHE_VERSION &&
+	         h->sample_rate >= SAMPLE_RATE_MIN && h->sample_rate <= SAMPLE_RATE_MAX && h->samples > 0 && h->key_len == (uint32_t)klen &&
+	         (long long)TTS_CACHE_HEADER + 4ll * h->samples + klen == (long long)st.st_size &&
+	         !memcmp((const uint8_t *)p + TTS_CACHE_HEADER + 4 * (size_t)h->samples, key, (size_t)klen);
+	if (ok) futimens(fd, NULL);   // recently used
+	close(fd);
+	if (!ok) {
+		if (p != MAP_FAILED) munmap(p, (size_t)st.st_size);
+		__atomic_fetch_add(&tts_cache.misses, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	__atomic_fetch_add(&tts_cache.hits, 1, __ATOMIC_RELAXED);
+	*len = (int)h->samples;
+	return (const float *)((const uint8_t *)p + TTS_CACHE_HEADER);
+}
+
+static void cache_release(const float *pcm)
+{
+	if (!pcm) return;
+	const TTSCacheHeader *h = (const TTSCacheHeader *)((const uint8_t *)pcm - TTS_CACHE_HEADER);
+	munmap((void *)h, TTS_CACHE_HEADER + 4 * (size_t)h->samples + h->key_len);
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+	while (len > 0) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return 0;
+		p += n; len -= (size_t)n;
+	}
+	return 1;
+}
+
+typedef struct {
+	char     *name;
+	long long size;
+	long long mtime;   // ns
+} CacheFile;
+
+static int cache_file_older(const void *a, const void *b)
+{
+	const CacheFile *x = (const CacheFile *)a, *y = (const CacheFile *)b;
+	return x->mtime < y->mtime ? -1 : x->mtime > y->mtime;
+}
+
+// recount the directory and drop the oldest entries until it is 90% of the
+// budget. one pass at a time per process, a pass racing another process
+// only deletes more than needed
+static void cache_evict(void)
+{
+	if (__atomic_exchange_n(&tts_cache.evicting, 1, __ATOMIC_ACQUIRE)) return;
+	DIR *d = opendir(tts_cache.dir);
+	CacheFile *files = NULL;
+	int n = 0, cap = 0;
+	long long total = 0;
+	time_t now = time(NULL);
+	char path[4096];
+	struct dirent *e;
+	while (d && (e = readdir(d)) != NULL) {
+		int entry = strlen(e->d_name) == 20 && !strcmp(e->d_name + 16, ".pcm");
+		int temp  = !strncmp(e->d_name, ".tmp-", 5);
+		if (!entry && !temp) continue;
+		struct stat st;
+		snprintf(path, sizeof(path), "%s/%s", tts_cache.dir, e->d_name);
+		if (stat(path, &st) != 0) continue;
+		if (temp) {
+			// left by a writer that died
+			if (now - st.st_mtime > TTS_CACHE_STALE) unlink(path);
+			continue;
+		}
+		if (n == cap) {
+			int nc = cap ? cap * 2 : 256;
+			CacheFile *nf = (CacheFile *)realloc(files, (size_t)nc * sizeof(CacheFile));
+			if (!nf) break;
+			files = nf; cap = nc;
+		}
+		files[n].name  = strdup(e->d_name);
+		files[n].size  = (long long)st.st_size;
+		files[n].mtime = (long long)st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+		if (!files[n].name) break;
+		total += files[n++].size;
+	}
+	if (d) closedir(d);
+
+	if (total > tts_cache.max_bytes) {
+		qsort(files, (size_t)n, sizeof(CacheFile), cache_file_older);
+		long long keep = tts_cache.max_bytes / 10 * 9;
+		for (int i = 0; i < n && total > keep; i++) {
+			snprintf(path, sizeof(path), "%s/%s", tts_cache.dir, files[i].name);
+			if (unlink(path) == 0) total -= files[i].size;
+		}
+	}
+	for (int i = 0; i < n; i++) free(files[i].name);
+	free(files);
+	__atomic_store_n(&tts_cache.bytes, total, __ATOMIC_RELAXED);
+	__atomic_store_n(&tts_cache.evicting, 0, __ATOMIC_RELEASE);
+}
+
+// write an entry through a temp file and rename it into place
+static int cache_store(const char *key, int klen, const float *pcm, int n, int sr)
+{
+	char path[4096], tmp[4096];
+	if (!tts_cache.dir || !key || !pcm || n <= 0 || !cache_path(path, sizeof(path), key, klen)) return 0;
+	uint32_t seq = __atomic_fetch_add(&tts_cache.tmp_seq, 1, __ATOMIC_RELAXED);
+	snprintf(tmp, sizeof(tmp), "%s/.tmp-%ld-%u", tts_cache.dir, (long)getpid(), seq);
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) return 0;
+
+	TTSCacheHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, TTS_CACHE_MAGIC, 4);
+	h.version     = TTS_CACHE_VERSION;
+	h.sample_rate = (uint32_t)sr;
+	h.samples     = (uint32_t)n;
+	h.key_len     = (uint32_t)klen;
+	int ok = write_all(fd, &h, sizeof(h)) && write_all(fd, pcm, (size_t)n * sizeof(float)) &&
+	         write_all(fd, key, (size_t)klen);
+	if (close(fd) != 0) ok = 0;
+	if (!ok || rename(tmp, path) != 0) { unlink(tmp); return 0; }
+
+	long long size = TTS_CACHE_HEADER + 4ll * n + klen;
+	if (__atomic_add_fetch(&tts_cache.bytes, size, __ATOMIC_RELAXED) > tts_cache.max_bytes) cache_evict();
+	return 1;
+}
+
+// use dir as the pcm cache, created if missing, kept under max_bytes.
+// dir NULL turns the cache off. returns 1 on success
+int tts_cache_open(const char *dir, long long max_bytes)
+{
+	free(tts_cache.dir);
+	tts_cache.dir = NULL;
+	if (!dir) return 1;
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) return 0;
+	size_t n = strlen(dir);
+	while (n > 1 && dir[n - 1] == '/') n--;
+	tts_cache.dir = strndup(dir, n);
+	if (!tts_cache.dir) return 0;
+	tts_cache.max_bytes = max_bytes > 0 ? max_bytes : 0x7FFFFFFFFFFFFFFFll;
+	cache_evict();
+	return 1;
+}
+
+// tts_speak through the cache. with a seed set the normalised text is
+// rendered as the first utterance after tts_set_seed, so the result only
+// depends on the key; unseeded calls fall through to tts_speak
+int tts_speak_cached(const char *txt)
+{
+	tts_ctx.out_len = 0;
+	if (!txt) return 0;
+	if (!tts_cache.dir || !tts_ctx.seed) return tts_speak(txt);
+	char *norm = strdup(txt);
+	if (!norm) return 0;
+	cache_norm(norm);
+
+	// entries are float, other formats are converted from them
+	int format = tts_ctx.format, klen = 0, n = 0;
+	tts_ctx.format = TTS_FMT_F32;
+	char *key = cache_key(&tts_ctx, TTS_CACHE_WHOLE, norm, &klen);
+	const float *hit = cache_lookup(key, klen, &n);
+	if (hit) {
+		tts_ctx.tl_len = 0;   // no front end ran, so no timeline either
+		if (ctx_reserve_out(&tts_ctx, n)) {
+			memcpy(tts_ctx.out, hit, (size_t)n * sizeof(float));
+			tts_ctx.out_len = n;
+		}
+		cache_release(hit);
+	} else {
+		tts_ctx.rng = 0;
+		if (tts_speak(norm) > 0) cache_store(key, klen, tts_ctx.out, tts_ctx.out_len, ctx_rate(&tts_ctx));
+	}
+	tts_ctx.format = format;
+	tts_ctx.rng = 0;
+	if (format != TTS_FMT_F32 && tts_ctx.out_len > 0) {
+		OutFmt of = ctx_outfmt(&tts_ctx);
+		for (int i = 0; i < tts_ctx.out_len; i++) fmt_store(&of, tts_ctx.out, i, tts_ctx.out[i]);
+		tts_ctx.rng = 0;
+	}
+	free(key);
+	free(norm);
+	return tts_ctx.out_len;
+}
+#endif
+
+// time-scale and pitch modification of rendered audio
+static TSMState tts_tsm;
+static float   *tts_stretch_buf = NULL;
+static int      tts_stretch_cap = 0;
+
+// change tempo by speed and pitch by the ratio pitch, independently,
+// without re-synthesis. in may be tts_get_buf(); returns sample count,
+// the result stays in tts_get_stretch_buf() until the next call
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_stretch(const float *in, int len, double speed, double pitch)
+{
+	if (!in || len <= 0) return 0;
+	int cap = tsm_length(len, (float)speed) + 256;
+	if (cap > tts_stretch_cap) {
+		float *nb = (float *)realloc(tts_stretch_buf, (size_t)cap * sizeof(float));
+		if (!nb) return 0;
+		tts_stretch_buf = nb;
+		tts_stretch_cap = cap;
+	}
+
+	tsm_init(&tts_tsm, in, len, ctx_rate(&tts_ctx));
+	tsm_set_params(&tts_tsm, (float)speed, (float)pitch);
+	int n = 0, got;
+	while (n < cap && (got = tsm_process(&tts_tsm, tts_stretch_buf + n, cap - n)) > 0) n += got;
+	return n;
+}
+
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+float *tts_get_stretch_buf(void) { return tts_stretch_buf; }
+
+// convert n float samples to format (see tts_set_output_format) into out,
+// which may be in. returns samples written
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_convert(const float *in, int n, int format, int dither, void *out)
+{
+	if (!in || !out || n <= 0) return 0;
+	OutFmt f = { format, format == TTS_FMT_S16 && dither, 0 };
+	if (f.dither) f.rng = rng_mix(ctx_rand(&tts_ctx)) | 1u;
+	if (format == TTS_FMT_S16 && !f.dither) {
+		// no state between samples, this loop vectorises
+		int16_t *o = (int16_t *)out;
+		for (int i = 0; i < n; i++) o[i] = (int16_t)codec_s16(in[i]);
+	} else if (format == TTS_FMT_S16 || format == TTS_FMT_ULAW) {
+		for (int i = 0; i < n; i++) fmt_store(&f, out, i, in[i]);
+	} else if (out != in) {
+		memmove(out, in, (size_t)n * sizeof(float));
+	}
+	return n;
+}
+
+// streaming wav export
+// the utterance is stretched a block at a time and handed out as wav data,
+// so exporting holds one block whatever the duration. the header comes
+// last, from tts_export_header once the size is known
+#define TTS_EXPORT_BLOCK 4096
+
+static struct {
+	TSMState tsm;
+	OutFmt   fmt;
+	int      rate;
+	int      left;       // output samples allowed, like tts_stretch's cap
+	uint32_t data_bytes;
+	float    blk[TTS_EXPORT_BLOCK];
+	uint8_t  hdr[WAV_HEADER_BYTES];
+} tts_export;
+
+// start exporting in (which must stay valid until the last read) at speed
+// and pitch as tts_stretch does, in format (TTS_FMT_*). returns 0 if the
+// arguments are unusable
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_export_begin(const float *in, int len, double speed, double pitch, int format, int dither)
+{
+	if (!in || len <= 0 || format < TTS_FMT_F32 || format > TTS_FMT_ULAW) return 0;
+	tts_export.rate = ctx_rate(&tts_ctx);
+	tsm_init(&tts_export.tsm, in, len, tts_export.rate);
+	tsm_set_params(&tts_export.tsm, (float)speed, (float)pitch);
+	OutFmt f = { format, format == TTS_FMT_S16 && dither, 0 };
+	if (f.dither) f.rng = rng_mix(ctx_rand(&tts_ctx)) | 1u;
+	tts_export.fmt        = f;
+	tts_export.left       = tsm_length(len, (float)speed) + 256;
+	tts_export.data_bytes = 0;
+	return 1;
+}
+
+// next wav data, up to cap bytes, into dst. returns bytes written, 0 once
+// the utterance is through
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_export_read(void *dst, int cap)
+{
+	int bytes = fmt_bytes(tts_export.fmt.format);
+	int want = cap / bytes, n = 0;
+	if (want > tts_export.left) want = tts_export.left;
+	while (n < want) {
+		int m = want - n < TTS_EXPORT_BLOCK ? want - n : TTS_EXPORT_BLOCK;
+		int got = tsm_process(&tts_export.tsm, tts_export.blk, m);
+		if (got <= 0) break;
+		uint8_t *o = (uint8_t *)dst + (size_t)n * bytes;
+		for (int i = 0; i < got; i++) fmt_store(&tts_export.fmt, o, i, tts_export.blk[i]);
+		n += got;
+	}
+	tts_export.left       -= n;
+	tts_export.data_bytes += (uint32_t)n * bytes;
+	return n * bytes;
+}
+
+// the 44 byte wav header for the data read so far
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+const uint8_t *tts_export_header(void)
+{
+	wav_header(tts_export.hdr, tts_export.fmt.format, tts_export.rate, tts_export.data_bytes);
+	return tts_export.hdr;
+}
+
+#ifndef __EMSCRIPTEN__
+// write in to path as a wav file, stretched like tts_stretch. the data
+// reaches the file WAV_FILE_BUF bytes at a time. returns 1 on success
+int tts_export_file(const char *path, const float *in, int len, double speed, double pitch, int format, int dither)
+{
+	static uint8_t chunk[TTS_EXPORT_BLOCK * 4];
+	if (!path || !tts_export_begin(in, len, speed, pitch, format, dither)) return 0;
+	WavFile *w = (WavFile *)malloc(sizeof(WavFile));
+	if (!w) return 0;
+	if (!wav_open(w, path, format, tts_export.rate)) { free(w); return 0; }
+	int got;
+	while ((got = tts_export_read(chunk, (int)sizeof(chunk))) > 0) wav_write_raw(w, chunk, got);
+	int ok = wav_close(w);
+	free(w);
+	return ok;
+}
+#endif
+
+// compressed storage of finished utterances
+// codec is TTS_CODEC_ULAW (8 bit) or TTS_CODEC_ADPCM (4 bit), see tts_codec.h
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_encoded_size(int codec, int n) { return codec_size(codec, n); }
+
+// encode n samples into out (tts_encoded_size bytes), returns bytes written
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_encode(int codec, const float *in, int n, uint8_t *out)
+{
+	if (!in || !out || n <= 0) return 0;
+	if (codec == TTS_CODEC_ULAW) { ulaw_encode(in, n, out); return n; }
+	if (codec == TTS_CODEC_ADPCM) return adpcm_encode(in, n, out);
+	return 0;
+}
+
+// decode samples [first, first + count) of an n sample stream, so playback
+// can decode as it goes. returns samples written
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_decode(int codec, const uint8_t *in, int n, int first, int count, float *out)
+{
+	if (!in || !out || first < 0 || first >= n || count <= 0) return 0;
+	if (count > n - first) count = n - first;
+	if (codec == TTS_CODEC_ULAW) { ulaw_decode(in + first, count, out); return count; }
+	if (codec == TTS_CODEC_ADPCM) return adpcm_decode(in, n, first, count, out);
+	return 0;
+}
+
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+float *tts_get_buf(void) { return tts_ctx.out; }
+
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int tts_get_len(void) { return tts_ctx.out_len; }
+
+// phone runs of the last utterance built by tts_speak, tts_prepare,
+// tts_stream_begin, tts_job_start or tts_compile (or rendered by
+// tts_render_compiled), tts_get_timeline_len() of them including the
+// closing run. valid until the next of those calls
 #ifdef __EMSCRIPTEN__
 EMSCRIPTEN_KEEPALIVE
 #endif
-float *tts_get_buf(void) { return tts_output_buf; }
+const TimelineRun *tts_get_timeline(void) { return tts_ctx.tl_len > 0 ? tts_ctx.tl : NULL; }
 
 #ifdef __EMSCRIPTEN__
 EMSCRIPTEN_KEEPALIVE
 #endif
-int tts_get_len(void) { return tts_output_len; }
+int tts_get_timeline_len(void) { return tts_ctx.tl_len; }
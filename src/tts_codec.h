@@ -0,0 +1,208 @@
+#pragma once
+
+/* compact storage of rendered speech
+ * mu-law (g.711, 8 bits per sample) and ima-adpcm (4 bits per sample) for
+ * keeping finished utterances in memory at a quarter or an eighth of their
+ * float size. adpcm uses the wav (ms ima) mono block layout: a 4 byte
+ * header with the first sample and the step index, then two samples per
+ * byte, low nibble first. blocks decode on their own, so any range can be
+ * decoded without touching what comes before it.
+ * the mu-law loops carry no state from one sample to the next and
+ * vectorise; adpcm is a recurrence inside a block and stays scalar. its
+ * decoder is a handful of integer operations per sample, the encoder
+ * searches and costs about 40 times as much, it runs once per utterance.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+enum {
+    TTS_CODEC_F32   = 0,   /* plain float, 4 bytes per sample */
+    TTS_CODEC_ULAW  = 1,
+    TTS_CODEC_ADPCM = 2
+};
+
+#define ADPCM_BLOCK_BYTES   256
+#define ADPCM_BLOCK_SAMPLES 505   /* header sample plus 2 * 252 nibbles */
+
+static const int16_t adpcm_steps[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+};
+
+static const int8_t adpcm_index_step[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+/* float in [-1, 1] to a rounded, clamped 16 bit sample */
+static inline int codec_s16(float x)
+{
+    float v = x * 32767.0f;
+    v = v > 32767.0f ? 32767.0f : (v < -32768.0f ? -32768.0f : v);
+    return (int)(v + (v >= 0.0f ? 0.5f : -0.5f));
+}
+
+/* bytes needed for n samples */
+static int codec_size(int codec, int n)
+{
+    if (n <= 0) return 0;
+    if (codec == TTS_CODEC_ULAW) return n;
+    if (codec == TTS_CODEC_ADPCM) {
+        int full = n / ADPCM_BLOCK_SAMPLES, rem = n % ADPCM_BLOCK_SAMPLES;
+        return full * ADPCM_BLOCK_BYTES + (rem ? 4 + rem / 2 : 0);
+    }
+    return n * 4;
+}
+
+/* mu-law */
+static inline uint8_t ulaw_encode1(float x)
+{
+    int s    = codec_s16(x);
+    int sign = s < 0 ? 0x80 : 0;
+    int mag  = (s < 0 ? -s : s);
+    mag = (mag > 32635 ? 32635 : mag) + 132;
+    int exp  = 31 - __builtin_clz((unsigned)mag) - 7;   /* 0 .. 7 */
+    int mant = (mag >> (exp + 3)) & 0x0F;
+    return (uint8_t)~(sign | (exp << 4) | mant);
+}
+
+static float ulaw_table[256];
+static int   ulaw_ready = 0;
+
+static void ulaw_init(void)
+{
+    if (ulaw_ready) return;
+    for (int i = 0; i < 256; i++) {
+        int u   = ~i & 0xFF;
+        int mag = ((((u & 0x0F) << 3) + 132) << ((u >> 4) & 7)) - 132;
+        ulaw_table[i] = (float)((u & 0x80) ? -mag : mag) / 32768.0f;
+    }
+    ulaw_ready = 1;
+}
+
+static void ulaw_encode(const float *in, int n, uint8_t *out)
+{
+    for (int i = 0; i < n; i++) out[i] = ulaw_encode1(in[i]);
+}
+
+static void ulaw_decode(const uint8_t *in, int n, float *out)
+{
+    ulaw_init();
+    for (int i = 0; i < n; i++) out[i] = ulaw_table[in[i]];
+}
+
+/* ima-adpcm */
+typedef struct {
+    int pred;    /* last reconstructed sample */
+    int index;   /* into adpcm_steps */
+} ADPCMState;
+
+static inline int adpcm_clamp16(int v)
+{
+    return v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+}
+
+/* reconstruct one nibble, the decoder and the encoder share it */
+static inline void adpcm_apply(ADPCMState *s, int code)
+{
+    int step  = adpcm_steps[s->index];
+    int delta = step >> 3;
+    if (code & 4) delta += step;
+    if (code & 2) delta += step >> 1;
+    if (code & 1) delta += step >> 2;
+    s->pred  = adpcm_clamp16(s->pred + ((code & 8) ? -delta : delta));
+    s->index += adpcm_index_step[code];
+    s->index = s->index < 0 ? 0 : (s->index > 88 ? 88 : s->index);
+}
+
+static inline int adpcm_code(const ADPCMState *s, int sample)
+{
+    int step = adpcm_steps[s->index];
+    int diff = sample - s->pred, code = 0;
+    if (diff < 0) { code = 8; diff = -diff; }
+    if (diff >= step) { code |= 4; diff -= step; }
+    step >>= 1;
+    if (diff >= step) { code |= 2; diff -= step; }
+    step >>= 1;
+    if (diff >= step) code |= 1;
+    return code;
+}
+
+/* squared error of code c at x, plus that of the greedy code for the
+ * next sample x1 (if any) */
+static inline int64_t adpcm_cost(ADPCMState s, int c, int x, int x1, int has_next)
+{
+    adpcm_apply(&s, c);
+    int64_t e = x - s.pred, cost = e * e;
+    if (has_next) {
+        adpcm_apply(&s, adpcm_code(&s, x1));
+        e = x1 - s.pred;
+        cost += e * e;
+    }
+    return cost;
+}
+
+/* encode n samples, returns bytes written (codec_size). the greedy code
+ * for each sample can starve or overshoot the step size; trying all 16
+ * codes against one sample of lookahead steers it and gains about 4 db
+ * on our speech, the stream stays plain ima-adpcm */
+static int adpcm_encode(const float *in, int n, uint8_t *out)
+{
+    ADPCMState s = { 0, 0 };
+    uint8_t *o = out;
+    for (int b = 0; b < n; b += ADPCM_BLOCK_SAMPLES) {
+        int m = n - b < ADPCM_BLOCK_SAMPLES ? n - b : ADPCM_BLOCK_SAMPLES;
+        s.pred = codec_s16(in[b]);
+        o[0] = (uint8_t)s.pred; o[1] = (uint8_t)(s.pred >> 8);
+        o[2] = (uint8_t)s.index; o[3] = 0;
+        o += 4;
+        int x = m > 1 ? codec_s16(in[b + 1]) : 0;
+        for (int i = 1; i < m; i++) {
+            int has_next = i + 1 < m;
+            int x1 = has_next ? codec_s16(in[b + i + 1]) : 0;
+            int best = 0;
+            int64_t best_cost = adpcm_cost(s, 0, x, x1, has_next);
+            for (int c = 1; c < 16; c++) {
+                int64_t cost = adpcm_cost(s, c, x, x1, has_next);
+                if (cost < best_cost) { best_cost = cost; best = c; }
+            }
+            adpcm_apply(&s, best);
+            if (i & 1) *o = (uint8_t)best;
+            else *o++ |= (uint8_t)(best << 4);
+            x = x1;
+        }
+        if (m > 1 && !(m & 1)) o++;   /* odd nibble count, last byte half used */
+    }
+    return (int)(o - out);
+}
+
+/* decode samples [first, first + count) of an n sample stream into out,
+ * returns samples written */
+static int adpcm_decode(const uint8_t *in, int n, int first, int count, float *out)
+{
+    if (first < 0 || first >= n || count <= 0) return 0;
+    if (count > n - first) count = n - first;
+    const float scale = 1.0f / 32768.0f;
+    int b = first / ADPCM_BLOCK_SAMPLES, skip = first - b * ADPCM_BLOCK_SAMPLES, w = 0;
+    for (; w < count; b++, skip = 0) {
+        const uint8_t *p = in + (size_t)b * ADPCM_BLOCK_BYTES;
+        int m = n - b * ADPCM_BLOCK_SAMPLES;
+        if (m > ADPCM_BLOCK_SAMPLES) m = ADPCM_BLOCK_SAMPLES;
+        ADPCMState s;
+        s.pred  = (int16_t)(p[0] | (p[1] << 8));
+        s.index = p[2] > 88 ? 88 : p[2];
+        p += 4;
+        if (skip == 0) out[w++] = (float)s.pred * scale;
+        for (int i = 1; i < m && w < count; i++) {
+            int code = (i & 1) ? (p[(i - 1) >> 1] & 0x0F) : (p[(i - 1) >> 1] >> 4);
+            adpcm_apply(&s, code);
+            if (i >= skip) out[w++] = (float)s.pred * scale;
+        }
+    }
+    return w;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+/* precompiled utterance format
+ * a compiled blob is a header followed by the parameter columns of a
+ * TTSSeq laid out exactly as seq_bind_columns() expects, so a blob that
+ * sits in memory (mmapped file, wasm heap) renders without copying.
+ * fields are in the byte order of the host that wrote the blob, which
+ * byte_order records; ksec_view rejects blobs from the other order.
+ * offsets are relative to the blob start.
+ */
+
+#include "tts_synth.h"
+
+#define KSEC_MAGIC    "KSEC"
+#define KSEC_VERSION  2
+#define KSEC_BYTE_ORDER 0x01020304u   /* written as a native uint32 */
+
+typedef struct {
+    char     magic[4];       /* KSEC_MAGIC */
+    uint16_t version;        /* KSEC_VERSION */
+    uint16_t header_bytes;   /* offset of the first column */
+    uint32_t frames;         /* number of frames */
+    uint32_t capacity;       /* column stride in frames, multiple of 4 */
+    uint32_t sample_rate;    /* rate the frame lengths were computed for */
+    uint32_t total_samples;  /* sum of frame lengths */
+    uint32_t byte_order;     /* KSEC_BYTE_ORDER */
+    uint32_t reserved;
+} KSECHeader;
+
+/* size in bytes of a blob holding n frames */
+static size_t ksec_size(int n)
+{
+    size_t cap = (size_t)((n + 3) & ~3);
+    return sizeof(KSECHeader) + cap * SEQ_FRAME_BYTES;
+}
+
+/* serialise the parameter columns of t into out (ksec_size bytes) */
+static void ksec_write(const TTSSeq *t, void *out)
+{
+    int n   = t->seqLen;
+    int cap = (n + 3) & ~3;
+    uint8_t *base = (uint8_t *)out;
+    memset(base, 0, ksec_size(n));
+
+    KSECHeader *h = (KSECHeader *)base;
+    memcpy(h->magic, KSEC_MAGIC, 4);
+    h->version      = KSEC_VERSION;
+    h->header_bytes = (uint16_t)sizeof(KSECHeader);
+    h->byte_order   = KSEC_BYTE_ORDER;
+    h->frames       = (uint32_t)n;
+    h->capacity     = (uint32_t)cap;
+    h->sample_rate  = (uint32_t)(t->sample_rate > 0 ? t->sample_rate : SAMPLE_RATE);
+    uint64_t total = 0;
+    for (int i = 0; i < n; i++) total += (uint64_t)t->totalSamples[i];
+    h->total_samples = (total > 0xFFFFFFFFu) ? 0xFFFFFFFFu : (uint32_t)total;
+
+    TTSSeq dst;
+    memset(&dst, 0, sizeof(dst));
+    seq_bind_columns(&dst, base + sizeof(KSECHeader), cap);
+    size_t sz = (size_t)n;
+    memcpy(dst.totalSamples, t->totalSamples, sz * 4);
+    memcpy(dst.attack,       t->attack,       sz * 4);
+    memcpy(dst.release,      t->release,      sz * 4);
+    memcpy(dst.code,         t->code,         sz * 4);
+    memcpy(dst.amplitude,    t->amplitude,    sz * 4);
+    memcpy(dst.f1,           t->f1,           sz * 2);
+    memcpy(dst.f2,           t->f2,           sz * 2);
+    memcpy(dst.f3,           t->f3,           sz * 2);
+    memcpy(dst.pitch,        t->pitch,        sz * 2);
+    memcpy(dst.f0,           t->f0,           sz * 2);
+    memcpy(dst.type,         t->type,         sz);
+    memcpy(dst.flags,        t->flags,        sz);
+}
+
+/* point view at the columns inside blob without copying.
+ * returns 0 if the blob is malformed, misaligned, from another version or
+ * written in the other byte order. */
+static int ksec_view(const void *blob, size_t len, TTSSeq *view)
+{
+    if (!blob || !view || len < sizeof(KSECHeader)) return 0;
+    if (((uintptr_t)blob & 3u) != 0) return 0;
+    const KSECHeader *h = (const KSECHeader *)blob;
+    if (memcmp(h->magic, KSEC_MAGIC, 4) != 0) return 0;
+    if (h->byte_order != KSEC_BYTE_ORDER) return 0;
+    if (h->version != KSEC_VERSION) return 0;
+    if (h->header_bytes < sizeof(KSECHeader) || (h->header_bytes & 3u)) return 0;
+    if (h->sample_rate < SAMPLE_RATE_MIN || h->sample_rate > SAMPLE_RATE_MAX) return 0;
+    if (h->frames > h->capacity || (h->capacity & 3u) || h->capacity > (1u << 24)) return 0;
+    if ((size_t)h->header_bytes + (size_t)h->capacity * SEQ_FRAME_BYTES > len) return 0;
+
+    memset(view, 0, sizeof(*view));
+    seq_bind_columns(view, (uint8_t *)blob + h->header_bytes, (int)h->capacity);
+    view->seqLen   = (int)h->frames;
+    view->capacity    = (int)h->capacity;
+    view->sample_rate = (int)h->sample_rate;
+    view->mem         = NULL;
+
+    for (int i = 0; i < view->seqLen; i++) {
+        if (view->type[i] > vtype_silence || view->totalSamples[i] < 0) return 0;
+    }
+    return 1;
+}
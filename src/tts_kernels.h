@@ -0,0 +1,431 @@
+#pragma once
+
+/* synthesis kernels and their runtime dispatch
+ * a table of function pointers for the glottal harmonic sum and the
+ * resampler's two dot products. native x86 binds the fastest path the cpu
+ * runs, up to avx2, before main; TTS_KERNELS=scalar|sse2|avx2|avx512
+ * overrides. wasm carries simd128 or scalar as built. a path is bound only
+ * if it passes kn_conforms.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if !defined(__EMSCRIPTEN__) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && defined(__SSE2__)
+#define KN_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+#define KN_MAX_HARMONICS 40   /* glottal harmonics, see load_frame */
+
+typedef struct {
+    const char *name;
+    char        cpu[48];   /* simd the cpu has, filled by tts_kernels_init */
+    char        rejected[32];  /* paths that failed kn_conforms at init */
+    /* sum of sin(h * phase) / h for h = 1 .. n, n <= KN_MAX_HARMONICS */
+    double (*harmonics)(double phase, int n);
+    /* sum of h[j] * x[j] and g[j] * x[j] for n (a multiple of 4) taps */
+    void   (*dot2)(const float *h, const float *g, const float *x, int n, float *a, float *b);
+} TTSKernels;
+
+/* 1 / h, zero past the last harmonic so a vector may run over the end */
+static const double kn_inv[KN_MAX_HARMONICS + 8] = {
+    0.0,      1.0,      1.0 / 2,  1.0 / 3,  1.0 / 4,  1.0 / 5,  1.0 / 6,  1.0 / 7,
+    1.0 / 8,  1.0 / 9,  1.0 / 10, 1.0 / 11, 1.0 / 12, 1.0 / 13, 1.0 / 14, 1.0 / 15,
+    1.0 / 16, 1.0 / 17, 1.0 / 18, 1.0 / 19, 1.0 / 20, 1.0 / 21, 1.0 / 22, 1.0 / 23,
+    1.0 / 24, 1.0 / 25, 1.0 / 26, 1.0 / 27, 1.0 / 28, 1.0 / 29, 1.0 / 30, 1.0 / 31,
+    1.0 / 32, 1.0 / 33, 1.0 / 34, 1.0 / 35, 1.0 / 36, 1.0 / 37, 1.0 / 38, 1.0 / 39,
+    1.0 / 40
+};
+
+/* the harmonics come from rotating (cos, sin) by the phase, two libm
+ * calls per sample instead of one per harmonic. the vector versions keep
+ * harmonics h .. h + lanes - 1 in their lanes and rotate all of them by
+ * lanes * phase per step */
+static double kn_harmonics_scalar(double phase, int n)
+{
+    double s1 = sin(phase), c1 = cos(phase);
+    double s = s1, c = c1, sum = 0.0;
+    for (int h = 1; h <= n; h++) {
+        sum += s * kn_inv[h];
+        double t = s * c1 + c * s1;
+        c = c * c1 - s * s1;
+        s = t;
+    }
+    return sum;
+}
+
+/* sin and cos of h * phase for h = 1 .. lanes (a power of two), the
+ * start of the vectors. each round rotates the lanes so far by the last
+ * of them, doubling their count */
+static inline void kn_first_lanes(double phase, int lanes, double *s, double *c)
+{
+    s[0] = sin(phase); c[0] = cos(phase);
+    for (int m = 1; m < lanes; m *= 2) {
+        double sm = s[m - 1], cm = c[m - 1];
+        for (int j = 0; j < m; j++) {
+            s[m + j] = s[j] * cm + c[j] * sm;
+            c[m + j] = c[j] * cm - s[j] * sm;
+        }
+    }
+}
+
+static void kn_dot2_scalar(const float *h, const float *g, const float *x, int n, float *a, float *b)
+{
+    float a0 = 0.0f, a1 = 0.0f, a2 = 0.0f, a3 = 0.0f;
+    float b0 = 0.0f, b1 = 0.0f, b2 = 0.0f, b3 = 0.0f;
+    for (int j = 0; j < n; j += 4) {
+        a0 += h[j] * x[j];     b0 += g[j] * x[j];
+        a1 += h[j + 1] * x[j + 1]; b1 += g[j + 1] * x[j + 1];
+        a2 += h[j + 2] * x[j + 2]; b2 += g[j + 2] * x[j + 2];
+        a3 += h[j + 3] * x[j + 3]; b3 += g[j + 3] * x[j + 3];
+    }
+    *a = (a0 + a1) + (a2 + a3);
+    *b = (b0 + b1) + (b2 + b3);
+}
+
+#if defined(__wasm_simd128__)
+static double kn_harmonics_simd128(double phase, int n)
+{
+    double s0[2], c0[2];
+    kn_first_lanes(phase, 2, s0, c0);
+    v128_t s = wasm_v128_load(s0), c = wasm_v128_load(c0);
+    v128_t sk = wasm_f64x2_splat(s0[1]), ck = wasm_f64x2_splat(c0[1]);
+    v128_t sum = wasm_f64x2_splat(0.0);
+    for (int h = 1; h <= n; h += 2) {
+        v128_t w = wasm_v128_load(kn_inv + h);
+        if (h == n) w = wasm_f64x2_replace_lane(w, 1, 0.0);
+        sum = wasm_f64x2_add(sum, wasm_f64x2_mul(s, w));
+        v128_t t = wasm_f64x2_add(wasm_f64x2_mul(s, ck), wasm_f64x2_mul(c, sk));
+        c = wasm_f64x2_sub(wasm_f64x2_mul(c, ck), wasm_f64x2_mul(s, sk));
+        s = t;
+    }
+    return wasm_f64x2_extract_lane(sum, 0) + wasm_f64x2_extract_lane(sum, 1);
+}
+
+static void kn_dot2_simd128(const float *h, const float *g, const float *x, int n, float *a, float *b)
+{
+    v128_t va = wasm_f32x4_splat(0.0f), vb = va;
+    for (int j = 0; j < n; j += 4) {
+        v128_t vx = wasm_v128_load(x + j);
+        va = wasm_f32x4_add(va, wasm_f32x4_mul(wasm_v128_load(h + j), vx));
+        vb = wasm_f32x4_add(vb, wasm_f32x4_mul(wasm_v128_load(g + j), vx));
+    }
+    *a = (wasm_f32x4_extract_lane(va, 0) + wasm_f32x4_extract_lane(va, 1)) +
+         (wasm_f32x4_extract_lane(va, 2) + wasm_f32x4_extract_lane(va, 3));
+    *b = (wasm_f32x4_extract_lane(vb, 0) + wasm_f32x4_extract_lane(vb, 1)) +
+         (wasm_f32x4_extract_lane(vb, 2) + wasm_f32x4_extract_lane(vb, 3));
+}
+#endif
+
+#if defined(__SSE2__) && !defined(__wasm_simd128__)
+static double kn_harmonics_sse2(double phase, int n)
+{
+    double s0[2], c0[2];
+    kn_first_lanes(phase, 2, s0, c0);
+    __m128d s = _mm_loadu_pd(s0), c = _mm_loadu_pd(c0);
+    __m128d sk = _mm_set1_pd(s0[1]), ck = _mm_set1_pd(c0[1]);
+    __m128d sum = _mm_setzero_pd();
+    for (int h = 1; h <= n; h += 2) {
+        __m128d w = _mm_loadu_pd(kn_inv + h);
+        if (h == n) w = _mm_move_sd(_mm_setzero_pd(), w);
+        sum = _mm_add_pd(sum, _mm_mul_pd(s, w));
+        __m128d t = _mm_add_pd(_mm_mul_pd(s, ck), _mm_mul_pd(c, sk));
+        c = _mm_sub_pd(_mm_mul_pd(c, ck), _mm_mul_pd(s, sk));
+        s = t;
+    }
+    double l[2];
+    _mm_storeu_pd(l, sum);
+    return l[0] + l[1];
+}
+
+static void kn_dot2_sse2(const float *h, const float *g, const float *x, int n, float *a, float *b)
+{
+    __m128 va = _mm_setzero_ps(), vb = va;
+    for (int j = 0; j < n; j += 4) {
+        __m128 vx = _mm_loadu_ps(x + j);
+        va = _mm_add_ps(va, _mm_mul_ps(_mm_loadu_ps(h + j), vx));
+        vb = _mm_add_ps(vb, _mm_mul_ps(_mm_loadu_ps(g + j), vx));
+    }
+    float la[4], lb[4];
+    _mm_storeu_ps(la, va);
+    _mm_storeu_ps(lb, vb);
+    *a = (la[0] + la[1]) + (la[2] + la[3]);
+    *b = (lb[0] + lb[1]) + (lb[2] + lb[3]);
+}
+#endif
+
+#ifdef KN_X86_DISPATCH
+/* weights of harmonics h .. h + 3, zero past n */
+__attribute__((target("avx2,fma")))
+static inline __m256d kn_weights4(int h, int n)
+{
+    __m256d w = _mm256_loadu_pd(kn_inv + h);
+    if (h + 3 <= n) return w;
+    __m256d idx = _mm256_set_pd(h + 3, h + 2, h + 1, h);
+    return _mm256_and_pd(w, _mm256_cmp_pd(idx, _mm256_set1_pd(n), _CMP_LE_OQ));
+}
+
+__attribute__((target("avx2,fma")))
+static double kn_harmonics_avx2(double phase, int n)
+{
+    double s0[4], c0[4];
+    kn_first_lanes(phase, 4, s0, c0);
+    __m256d s = _mm256_loadu_pd(s0), c = _mm256_loadu_pd(c0);
+    __m256d sk = _mm256_set1_pd(s0[3]), ck = _mm256_set1_pd(c0[3]);
+    __m256d sum = _mm256_setzero_pd();
+    for (int h = 1; h <= n; h += 4) {
+        sum = _mm256_fmadd_pd(s, kn_weights4(h, n), sum);
+        __m256d t = _mm256_fmadd_pd(s, ck, _mm256_mul_pd(c, sk));
+        c = _mm256_fmsub_pd(c, ck, _mm256_mul_pd(s, sk));
+        s = t;
+    }
+    __m128d lo = _mm256_castpd256_pd128(sum), hi = _mm256_extractf128_pd(sum, 1);
+    __m128d r = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(r, _mm_unpackhi_pd(r, r)));
+}
+
+__attribute__((target("avx2,fma")))
+static inline float kn_hsum8(__m256 v)
+{
+    __m128 r = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    r = _mm_add_ps(r, _mm_movehl_ps(r, r));
+    return _mm_cvtss_f32(_mm_add_ss(r, _mm_shuffle_ps(r, r, 1)));
+}
+
+__attribute__((target("avx2,fma")))
+static void kn_dot2_avx2(const float *h, const float *g, const float *x, int n, float *a, float *b)
+{
+    __m256 va = _mm256_setzero_ps(), vb = va;
+    int j = 0;
+    for (; j + 8 <= n; j += 8) {
+        __m256 vx = _mm256_loadu_ps(x + j);
+        va = _mm256_fmadd_ps(_mm256_loadu_ps(h + j), vx, va);
+        vb = _mm256_fmadd_ps(_mm256_loadu_ps(g + j), vx, vb);
+    }
+    if (j < n) {   /* four taps left */
+        __m256 vx = _mm256_castps128_ps256(_mm_loadu_ps(x + j));
+        __m256 z  = _mm256_setzero_ps();
+        va = _mm256_fmadd_ps(_mm256_insertf128_ps(z, _mm_loadu_ps(h + j), 0), vx, va);
+        vb = _mm256_fmadd_ps(_mm256_insertf128_ps(z, _mm_loadu_ps(g + j), 0), vx, vb);
+    }
+    *a = kn_hsum8(va);
+    *b = kn_hsum8(vb);
+}
+
+__attribute__((target("avx512f")))
+static double kn_harmonics_avx512(double phase, int n)
+{
+    double s0[8], c0[8];
+    kn_first_lanes(phase, 8, s0, c0);
+    __m512d s = _mm512_loadu_pd(s0), c = _mm512_loadu_pd(c0);
+    __m512d sk = _mm512_set1_pd(s0[7]), ck = _mm512_set1_pd(c0[7]);
+    __m512d sum = _mm512_setzero_pd();
+    for (int h = 1; h <= n; h += 8) {
+        __mmask8 m = n - h >= 7 ? (__mmask8)0xFF : (__mmask8)((1u << (n - h + 1)) - 1);
+        sum = _mm512_mask3_fmadd_pd(s, _mm512_maskz_loadu_pd(m, kn_inv + h), sum, 0xFF);
+        __m512d t = _mm512_fmadd_pd(s, ck, _mm512_mul_pd(c, sk));
+        c = _mm512_fmsub_pd(c, ck, _mm512_mul_pd(s, sk));
+        s = t;
+    }
+    return _mm512_reduce_add_pd(sum);
+}
+
+__attribute__((target("avx512f")))
+static void kn_dot2_avx512(const float *h, const float *g, const float *x, int n, float *a, float *b)
+{
+    __m512 va = _mm512_setzero_ps(), vb = va;
+    for (int j = 0; j < n; j += 16) {
+        __mmask16 m = n - j >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (n - j)) - 1);
+        __m512 vx = _mm512_maskz_loadu_ps(m, x + j);
+        va = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, h + j), vx, va);
+        vb = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, g + j), vx, vb);
+    }
+    *a = _mm512_reduce_add_ps(va);
+    *b = _mm512_reduce_add_ps(vb);
+}
+#endif
+
+/* the path compiled in as the baseline, correct before any init */
+static TTSKernels tts_kernels = {
+#if defined(__wasm_simd128__)
+    "simd128", "", "", kn_harmonics_simd128, kn_dot2_simd128
+#elif defined(__SSE2__)
+    "sse2", "", "", kn_harmonics_sse2, kn_dot2_sse2
+#else
+    "scalar", "", "", kn_harmonics_scalar, kn_dot2_scalar
+#endif
+};
+
+/* the reference the paths are checked against: sin() per harmonic, as
+ * the glottal source computed it before the rotation, and dot products
+ * summed in double */
+static double kn_harmonics_ref(double phase, int n)
+{
+    double sum = 0.0;
+    for (int h = 1; h <= n; h++) sum += sin(h * phase) / h;
+    return sum;
+}
+
+static void kn_dot2_ref(const float *h, const float *g, const float *x, int n, float *a, float *b)
+{
+    double ra = 0.0, rb = 0.0;
+    for (int j = 0; j < n; j++) { ra += (double)h[j] * x[j]; rb += (double)g[j] * x[j]; }
+    *a = (float)ra;
+    *b = (float)rb;
+}
+
+static const TTSKernels tts_kernels_ref = { "reference", "", "", kn_harmonics_ref, kn_dot2_ref };
+
+#define KN_VARIANTS 4
+
+/* the paths this build carries and the cpu runs, slowest first, the
+ * scalar one always first. returns how many went into v */
+static int tts_kernels_list(TTSKernels *v)
+{
+    int n = 0;
+    memset(v, 0, KN_VARIANTS * sizeof(*v));
+    v[n].name = "scalar"; v[n].harmonics = kn_harmonics_scalar; v[n].dot2 = kn_dot2_scalar; n++;
+#if defined(__wasm_simd128__)
+    v[n].name = "simd128"; v[n].harmonics = kn_harmonics_simd128; v[n].dot2 = kn_dot2_simd128; n++;
+#elif defined(__SSE2__)
+    v[n].name = "sse2"; v[n].harmonics = kn_harmonics_sse2; v[n].dot2 = kn_dot2_sse2; n++;
+#endif
+#ifdef KN_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        v[n].name = "avx2"; v[n].harmonics = kn_harmonics_avx2; v[n].dot2 = kn_dot2_avx2; n++;
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        v[n].name = "avx512"; v[n].harmonics = kn_harmonics_avx512; v[n].dot2 = kn_dot2_avx512; n++;
+    }
+#endif
+    return n;
+}
+
+/* conformance bounds against tts_kernels_ref. the harmonic error is
+ * relative to the sum of 1 / h, the dot product error to the sum of
+ * |h * x|. float sums in any order stay within a few ulp of that, a
+ * broken kernel misses by orders of magnitude */
+#define KN_HARM_TOL 1e-12
+#define KN_DOT_TOL  1e-6
+
+typedef struct {
+    double harm_err, dot_err;   /* worst relative errors seen */
+} KNCheck;
+
+/* run k on fixed inputs: 24 phases over the cycle and every harmonic
+ * count, dot products of 4 .. 64 taps over noise. returns 1 if k stays
+ * within the bounds */
+static int kn_conforms(const TTSKernels *k, KNCheck *c)
+{
+    KNCheck r = { 0.0, 0.0 };
+    for (int p = 0; p < 24; p++) {
+        double phase = (p + 0.37) * (2.0 * 3.14159265358979323846 / 24);
+        double scale = 0.0;
+        for (int n = 1; n <= KN_MAX_HARMONICS; n++) {
+            scale += 1.0 / n;
+            double e = fabs(k->harmonics(phase, n) - kn_harmonics_ref(phase, n)) / scale;
+            if (!(e <= r.harm_err)) r.harm_err = e;   /* keeps a nan */
+        }
+    }
+    float h[64], g[64], x[64];
+    uint32_t st = 0x2545F491u;
+    for (int j = 0; j < 64; j++) {
+        st ^= st << 13; st ^= st >> 17; st ^= st << 5; h[j] = (float)(int32_t)st * (1.0f / 2147483648.0f);
+        st ^= st << 13; st ^= st >> 17; st ^= st << 5; g[j] = (float)(int32_t)st * (1.0f / 2147483648.0f);
+        st ^= st << 13; st ^= st >> 17; st ^= st << 5; x[j] = (float)(int32_t)st * (1.0f / 2147483648.0f);
+    }
+    for (int n = 4; n <= 64; n += 4) {
+        double sa = 0.0, sb = 0.0;
+        for (int j = 0; j < n; j++) { sa += fabs((double)h[j] * x[j]); sb += fabs((double)g[j] * x[j]); }
+        float a, b, ra, rb;
+        k->dot2(h, g, x, n, &a, &b);
+        kn_dot2_ref(h, g, x, n, &ra, &rb);
+        double ea = fabs(a - ra) / sa, eb = fabs(b - rb) / sb;
+        if (!(ea <= r.dot_err)) r.dot_err = ea;
+        if (!(eb <= r.dot_err)) r.dot_err = eb;
+    }
+    if (c) *c = r;
+    return r.harm_err <= KN_HARM_TOL && r.dot_err <= KN_DOT_TOL;
+}
+
+/* rank of a path for TTS_KERNELS, -1 for a name that is none */
+static int kn_level(const char *name)
+{
+    if (!strcmp(name, "scalar")) return 0;
+    if (!strcmp(name, "sse2") || !strcmp(name, "simd128")) return 1;
+    if (!strcmp(name, "avx2")) return 2;
+    if (!strcmp(name, "avx512")) return 3;
+    return -1;
+}
+
+/* bind the fastest path the cpu runs, up to avx2 or the one TTS_KERNELS
+ * names, that passes kn_conforms. a path that fails is skipped and
+ * named in tts_kernels.rejected. returns the path in use */
+static const char *tts_kernels_init(void)
+{
+    TTSKernels v[KN_VARIANTS];
+    int n = tts_kernels_list(v);
+    const char *want = getenv("TTS_KERNELS");
+    int level = want && kn_level(want) >= 0 ? kn_level(want) : 2;
+    tts_kernels.cpu[0] = tts_kernels.rejected[0] = 0;
+#ifdef KN_X86_DISPATCH
+    strcpy(tts_kernels.cpu, "sse2");
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) strcat(tts_kernels.cpu, " avx2");
+    if (__builtin_cpu_supports("avx512f")) strcat(tts_kernels.cpu, " avx512f");
+#endif
+    for (int i = n - 1; i >= 0; i--) {
+        if (kn_level(v[i].name) > level) continue;
+        if (i > 0 && !kn_conforms(&v[i], NULL)) {   /* scalar is the last resort */
+            size_t len = strlen(tts_kernels.rejected);
+            snprintf(tts_kernels.rejected + len, sizeof(tts_kernels.rejected) - len, "%s%s", len ? " " : "", v[i].name);
+            continue;
+        }
+        tts_kernels.name = v[i].name; tts_kernels.harmonics = v[i].harmonics; tts_kernels.dot2 = v[i].dot2;
+        break;
+    }
+    return tts_kernels.name;
+}
+
+#if defined(__GNUC__)
+__attribute__((constructor))
+static void kn_startup(void) { tts_kernels_init(); }
+#endif
+
+/* subnormals. the post chain flushes its float filter state below
+ * KN_FLUSH (-300 db), in wasm too. native x86 renders also set
+ * flush-to-zero and denormals-are-zero on the calling thread with
+ * kn_denormals_off and hand the old mode back to kn_denormals_restore */
+#define KN_FLUSH 1e-15
+
+static inline float kn_flushf(float v) { return fabsf(v) < (float)KN_FLUSH ? 0.0f : v; }
+
+#if defined(__SSE__) && !defined(__EMSCRIPTEN__)
+#include <xmmintrin.h>
+#define KN_MXCSR_FTZ_DAZ 0x8040u
+
+static inline unsigned kn_denormals_off(void)
+{
+    unsigned mode = _mm_getcsr();
+    if ((mode & KN_MXCSR_FTZ_DAZ) != KN_MXCSR_FTZ_DAZ) _mm_setcsr(mode | KN_MXCSR_FTZ_DAZ);
+    return mode;
+}
+
+static inline void kn_denormals_restore(unsigned mode)
+{
+    if ((mode & KN_MXCSR_FTZ_DAZ) != KN_MXCSR_FTZ_DAZ) _mm_setcsr(mode);
+}
+#else
+static inline unsigned kn_denormals_off(void)        { return 0; }
+static inline void kn_denormals_restore(unsigned mode) { (void)mode; }
+#endif
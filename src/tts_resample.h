@@ -0,0 +1,94 @@
+#pragma once
+
+/* polyphase windowed-sinc resampling kernel
+ * the hann-windowed sinc is sampled once per cutoff into RS_PHASES + 1
+ * rows of taps, one row per fractional read position. a read blends the
+ * two rows around its position, which costs two dot products and no
+ * transcendental or table interpolation per tap. rows are padded to a
+ * multiple of 4 taps. the dot products are a dispatched kernel
+ * (tts_kernels.h): 4 to 16 lanes wide, four scalar accumulators without
+ * simd.
+ * the ratio may change on every read; the cutoff follows it in
+ * RS_CUT_STEPS steps, so a gliding ratio rebuilds the rows only now and
+ * then.
+ */
+
+#include <stdint.h>
+#include <math.h>
+
+#include "tts_kernels.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define RS_ZC          8      /* sinc zero crossings per side at full band */
+#define RS_PHASES      64     /* rows per sample interval */
+#define RS_MAX_DECIM   2      /* lowest cutoff is nyquist / RS_MAX_DECIM */
+#define RS_MIN_CUT     (1.0f / RS_MAX_DECIM)
+#define RS_CUT_STEPS   64     /* cutoff resolution, in fractions of nyquist */
+#define RS_MAX_HALF    (RS_ZC * RS_MAX_DECIM)
+#define RS_MAX_TAPS    (2 * RS_MAX_HALF)
+
+typedef struct {
+    float cut;    /* cutoff the rows hold, fraction of nyquist, 0 before the first build */
+    int   half;   /* taps on either side of the read position */
+    int   taps;   /* row length, 2 * half padded to a multiple of 4 */
+    float coef[(RS_PHASES + 1) * RS_MAX_TAPS];
+} RSKernel;
+
+/* sample the kernel for cutoff cut. each row sums to one, so the gain at
+ * dc does not ripple with the read position */
+static void rs_build(RSKernel *k, float cut)
+{
+    int half = (int)ceilf((float)RS_ZC / cut);
+    k->cut  = cut;
+    k->half = half;
+    k->taps = (2 * half + 3) & ~3;
+    for (int p = 0; p <= RS_PHASES; p++) {
+        float *row = k->coef + p * k->taps;
+        double frac = (double)p / RS_PHASES, sum = 0.0;
+        for (int j = 0; j < k->taps; j++) {
+            double d = fabs((double)(j - half + 1) - frac) * cut;
+            double h = 0.0;
+            if (d < RS_ZC) {
+                double w = 0.5 + 0.5 * cos(M_PI * d / RS_ZC);
+                h = d == 0.0 ? 1.0 : w * sin(M_PI * d) / (M_PI * d);
+            }
+            row[j] = (float)h;
+            sum += h;
+        }
+        /* at full band the sinc is zero on every other sample, keep the
+         * integer positions an exact copy of the input */
+        if (cut == 1.0f && (p == 0 || p == RS_PHASES)) {
+            for (int j = 0; j < k->taps; j++) row[j] = 0.0f;
+            row[p == 0 ? half - 1 : half] = 1.0f;
+            continue;
+        }
+        for (int j = 0; j < k->taps; j++) row[j] = (float)(row[j] / sum);
+    }
+}
+
+/* fit the cutoff to a read step (input samples per output sample), below
+ * nyquist of the output when decimating */
+static void rs_set_step(RSKernel *k, float step)
+{
+    float cut = step > 1.0f ? 1.0f / step : 1.0f;
+    cut = floorf(cut * RS_CUT_STEPS) / RS_CUT_STEPS;
+    if (cut < RS_MIN_CUT) cut = RS_MIN_CUT;
+    if (cut != k->cut) rs_build(k, cut);
+}
+
+/* the signal at x[0] + frac, 0 <= frac < 1. reads x[1 - half] up to
+ * x[taps - half], all of which must be valid */
+static inline float rs_read(const RSKernel *k, const float *x, float frac)
+{
+    float pf = frac * RS_PHASES;
+    int   p  = (int)pf;
+    if (p >= RS_PHASES) p = RS_PHASES - 1;
+    float w  = pf - (float)p;
+    const float *h = k->coef + p * k->taps;
+    float a, b;
+    tts_kernels.dot2(h, h + k->taps, x + 1 - k->half, k->taps, &a, &b);
+    return a + (b - a) * w;
+}
@@ -11,11 +11,18 @@
 #include <emscripten/emscripten.h>
 #endif
 
+#include "tts_kernels.h"
+
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
+/* default output rate; sequences carry their own (TTSSeq.sample_rate).
+ * the voice was tuned at this rate, the rate-dependent constants below
+ * are scaled from it */
 #define SAMPLE_RATE 16000
+#define SAMPLE_RATE_MIN 8000
+#define SAMPLE_RATE_MAX 96000
 #define TWO_PI (2.0 * M_PI)
 
 /* phoneme class definitions */
@@ -36,12 +43,101 @@ typedef struct {
     int      is_voiced;
 } PhonemeDef;
 
-/* runtime state for one synthesized segment */
+/* per-frame flag bits */
+#define FRAME_VOICED   0x01   /* glottal source mixed in */
+#define FRAME_WHISPER  0x02   /* vowel rendered as noise through widened bands */
+
+/* voice transform, applied to the phoneme parameters as frames are pushed,
+ * so every frame is written once and its filters derive from the result.
+ * one row per phoneme type and voicing says what such a frame becomes;
+ * transforms compose row by row into a single table (vx_then), so a stack
+ * of them costs one lookup per frame while building and nothing while
+ * rendering. silence is never transformed. */
+typedef struct {
+    float   f_scale;      /* f1..f3 multiplier */
+    float   amp_scale;
+    float   amp_max;      /* amplitude ceiling after scaling */
+    uint8_t type;         /* PhType the frame becomes */
+    uint8_t flags_clear;  /* FRAME_* bits removed, then */
+    uint8_t flags_set;    /* FRAME_* bits added */
+} VoiceRow;
+
+typedef struct VoiceXform {
+    VoiceRow row[vtype_silence][2];   /* by PhType, then voiced */
+    float    pitch_scale;             /* glottal pitch */
+} VoiceXform;
+
+static void vx_identity(VoiceXform *x)
+{
+    for (int t = 0; t < vtype_silence; t++) {
+        for (int v = 0; v < 2; v++) {
+            VoiceRow *r = &x->row[t][v];
+            r->f_scale = r->amp_scale = 1.0f;
+            r->amp_max = 1e30f;
+            r->type = (uint8_t)t;
+            r->flags_clear = r->flags_set = 0;
+        }
+    }
+    x->pitch_scale = 1.0f;
+}
+
+/* x becomes x followed by b */
+static void vx_then(VoiceXform *x, const VoiceXform *b)
+{
+    for (int t = 0; t < vtype_silence; t++) {
+        for (int v = 0; v < 2; v++) {
+            VoiceRow *r = &x->row[t][v];
+            uint8_t flags = (uint8_t)(((v ? FRAME_VOICED : 0) & ~r->flags_clear) | r->flags_set);
+            const VoiceRow *n = &b->row[r->type][(flags & FRAME_VOICED) != 0];
+            r->f_scale  *= n->f_scale;
+            r->amp_max   = r->amp_max * n->amp_scale < n->amp_max ? r->amp_max * n->amp_scale : n->amp_max;
+            r->amp_scale *= n->amp_scale;
+            r->type      = n->type;
+            r->flags_set   = (uint8_t)((r->flags_set & ~n->flags_clear) | n->flags_set);
+            r->flags_clear = (uint8_t)(r->flags_clear | n->flags_clear);
+        }
+    }
+    x->pitch_scale *= b->pitch_scale;
+}
+
+/* whispered speech: vowels turn to noise through widened bands (see
+ * load_frame), voiced consonants and stops lose their voicing */
+static void vx_whisper(VoiceXform *x)
+{
+    vx_identity(x);
+    for (int v = 0; v < 2; v++) {
+        VoiceRow *r = &x->row[vtype_vowel][v];
+        r->type        = vtype_fricative;
+        r->flags_clear = FRAME_VOICED;
+        r->flags_set   = FRAME_WHISPER;
+        r->amp_scale   = 1.8f;
+        r->amp_max     = 1.0f;
+    }
+    x->row[vtype_consonant][1].flags_clear = FRAME_VOICED;
+    x->row[vtype_consonant][1].amp_scale   = 1.3f;
+    x->row[vtype_consonant][1].amp_max     = 1.0f;
+    x->row[vtype_stop][1].flags_clear      = FRAME_VOICED;
+}
+
+/* a different vocal tract: every band moves by f_scale, the glottis by
+ * pitch_scale */
+static void vx_tract(VoiceXform *x, float f_scale, float pitch_scale)
+{
+    vx_identity(x);
+    for (int t = 0; t < vtype_silence; t++)
+        for (int v = 0; v < 2; v++) x->row[t][v].f_scale = f_scale;
+    x->pitch_scale = pitch_scale;
+}
+
+/* runtime state of the voice rendering the current frame.
+ * loaded from the parameter stream when a frame starts and reused
+ * for the next one, so only one of these exists per voice. */
 typedef struct {
     double sampleRate;
     int    totalSamples, currentSample;
     PhType type;
     int    is_voiced;
+    int    is_whisper;
     double amplitude;
     double f[3];
 
@@ -63,6 +159,8 @@ typedef struct {
 
     /* noise / burst state */
     double noise_hp;
+    double noise_a;      /* pre-emphasis zero, scaled to the rate */
+    double noise_gain;   /* keeps band noise level independent of the rate */
     int    burstRemaining;
 
     /* amplitude envelope state */
@@ -72,21 +170,70 @@ typedef struct {
     uint32_t dbg_code;
 } FormantData;
 
-/* ordered sequence of formant segments */
+/* ordered sequence of frames.
+ * static parameters are kept as parallel columns (32 bytes per frame);
+ * filter coefficients and state are derived per frame into voice. */
 typedef struct {
-    FormantData *seq;
-    int seqLen, currentIndex;
+    int       seqLen, capacity;
+    int32_t  *totalSamples;     /* frame length in samples */
+    int32_t  *attack, *release; /* envelope window lengths in samples */
+    uint32_t *code;             /* phone code or punctuation codepoint */
+    float    *amplitude;
+    uint16_t *f1, *f2, *f3;     /* formant / band centres in hz */
+    uint16_t *pitch;            /* glottal f0 in hz, 0 for silence */
+    uint16_t *f0;               /* prosody target f0 in hz, 0 when unset */
+    uint8_t  *type;             /* PhType */
+    uint8_t  *flags;            /* FRAME_* bits */
+    void     *mem;              /* owned column storage, NULL for views */
+
+    /* voice transform seq_push applies while building, NULL for none */
+    const VoiceXform *xf;
+
+    /* generator for pitch jitter while building, noise while rendering */
+    uint32_t rng;
+    int      sample_rate;       /* rate the frame lengths are counted in */
+
+    /* render cursor */
+    int         currentIndex;
+    FormantData voice;
 } TTSSeq;
 
+/* bytes of column storage per frame */
+#define SEQ_FRAME_BYTES (5 * 4 + 5 * 2 + 2 * 1)
+
 /* global speed multiplier */
 static double READ_SPEED = 1.0;
 
+/* xorshift32 generator for noise and pitch jitter, state must be non-zero */
+static inline uint32_t rng_next(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;  x ^= x >> 17;  x ^= x << 5;
+    return *state = x;
+}
+
+/* white noise in [-1, 1] */
+static inline double rng_white(uint32_t *state)
+{
+    return (double)rng_next(state) * (2.0 / 4294967295.0) - 1.0;
+}
+
+/* scramble a seed into a usable non-zero generator state */
+static inline uint32_t rng_mix(uint32_t x)
+{
+    x ^= x >> 16;  x *= 0x7FEB352Du;
+    x ^= x >> 15;  x *= 0x846CA68Bu;
+    x ^= x >> 16;
+    return x ? x : 0x9E3779B9u;
+}
+
 /* bandpass filter coefficient calculation */
 static void init_bandpass(double fs, double f0, double Q,
                           double *b0, double *b1, double *b2,
                           double *a1, double *a2)
 {
     if (f0 <= 0.0 || Q <= 0.0) { *b0=*b1=*b2=*a1=*a2=0.0; return; }
+    if (f0 > 0.49 * fs) f0 = 0.49 * fs;   /* bands above nyquist at low rates */
     double w0    = TWO_PI * f0 / fs;
     double alpha = sin(w0) / (2.0 * Q);
     double cosw0 = cos(w0);
@@ -101,6 +248,7 @@ static void init_lowpass(double fs, double fc,
                          double *b0, double *b1, double *b2,
                          double *a1, double *a2)
 {
+    if (fc > 0.49 * fs) fc = 0.49 * fs;
     double w0    = TWO_PI * fc / fs;
     double alpha = sin(w0) / (2.0 * 0.707);
     double cosw0 = cos(w0);
@@ -112,6 +260,28 @@ static void init_lowpass(double fs, double fc,
     *a2 = (1.0 - alpha) / a0;
 }
 
+/* gain of the noise pre-emphasis 1 - a z^-1 at f hz */
+static double preemph_gain(double a, double f, double fs)
+{
+    double w = TWO_PI * f / fs;
+    return sqrt(1.0 - 2.0 * a * cos(w) + a * a);
+}
+
+/* formant band idx of the voice. the bands were tuned at SAMPLE_RATE,
+ * where a band's digital width shrinks towards nyquist (alpha goes with
+ * sin w0); at other rates q is adjusted so the band keeps the width in hz
+ * it had there */
+static void voice_bandpass(FormantData *d, int idx, double f0, double Q)
+{
+    double fs = d->sampleRate;
+    if (fs != SAMPLE_RATE && f0 > 0.0) {
+        double f16 = f0 < 0.49 * SAMPLE_RATE ? f0 : 0.49 * SAMPLE_RATE;
+        double fr  = f0 < 0.49 * fs ? f0 : 0.49 * fs;
+        Q *= (sin(TWO_PI * fr / fs) * fs) / (sin(TWO_PI * f16 / SAMPLE_RATE) * SAMPLE_RATE);
+    }
+    init_bandpass(fs, f0, Q, &d->b0[idx], &d->b1[idx], &d->b2[idx], &d->a1[idx], &d->a2[idx]);
+}
+
 /* calculate current envelope amplitude */
 static double envelope_amp(FormantData *d)
 {
@@ -128,8 +298,7 @@ static double glottal_source(FormantData *d)
     double inc = TWO_PI * d->pitch / d->sampleRate;
     d->phase_f0 += inc;
     if (d->phase_f0 > TWO_PI) d->phase_f0 -= TWO_PI;
-    double src = 0.0;
-    for (int h = 1; h <= d->glottal_max_h; h++) src += sin(d->phase_f0 * h) / (double)h;
+    double src = tts_kernels.harmonics(d->phase_f0, d->glottal_max_h);
     return (src / d->glottal_norm) * 0.6;
 }
 
@@ -161,76 +330,233 @@ static double softclip(double x)
     return x;
 }
 
-/* initialize runtime formant data from phoneme definition */
-static void setup_formant(FormantData *d, PhonemeDef *pd,
-                          uint32_t dbg_code, double duration_override)
+/* carve the parameter columns out of one block of cap frames */
+static void seq_bind_columns(TTSSeq *t, uint8_t *mem, int cap)
 {
-    memset(d, 0, sizeof(FormantData));
-    d->sampleRate  = SAMPLE_RATE;
-    d->type        = pd->type;
-    d->is_voiced   = pd->is_voiced;
-    d->amplitude   = pd->amp;
-    d->f[0] = pd->f1;  d->f[1] = pd->f2;  d->f[2] = pd->f3;
-    d->dbg_code    = dbg_code;
+    size_t n = (size_t)cap;
+    t->totalSamples = (int32_t  *)mem;  mem += n * 4;
+    t->attack       = (int32_t  *)mem;  mem += n * 4;
+    t->release      = (int32_t  *)mem;  mem += n * 4;
+    t->code         = (uint32_t *)mem;  mem += n * 4;
+    t->amplitude    = (float    *)mem;  mem += n * 4;
+    t->f1           = (uint16_t *)mem;  mem += n * 2;
+    t->f2           = (uint16_t *)mem;  mem += n * 2;
+    t->f3           = (uint16_t *)mem;  mem += n * 2;
+    t->pitch        = (uint16_t *)mem;  mem += n * 2;
+    t->f0           = (uint16_t *)mem;  mem += n * 2;
+    t->type         = (uint8_t  *)mem;  mem += n;
+    t->flags        = (uint8_t  *)mem;
+}
+
+/* allocate an empty sequence with room for cap frames */
+static TTSSeq *seq_new(int cap)
+{
+    if (cap < 16) cap = 16;
+    cap = (cap + 3) & ~3;
+    TTSSeq *t = (TTSSeq *)calloc(1, sizeof(TTSSeq));
+    if (!t) return NULL;
+    t->mem = calloc((size_t)cap, SEQ_FRAME_BYTES);
+    if (!t->mem) { free(t); return NULL; }
+    seq_bind_columns(t, (uint8_t *)t->mem, cap);
+    t->capacity = cap;
+    t->rng = 0x9E3779B9u;
+    t->sample_rate = SAMPLE_RATE;
+    return t;
+}
+
+/* drop all frames but keep the column storage for reuse */
+static void seq_clear(TTSSeq *t)
+{
+    t->seqLen = 0;
+    t->currentIndex = 0;
+}
+
+/* make room for at least one more frame, repacking the columns */
+static int seq_reserve(TTSSeq *t, int need)
+{
+    if (need <= t->capacity) return 1;
+    int cap = t->capacity * 2;
+    if (cap < need) cap = need;
+    cap = (cap + 3) & ~3;
+    TTSSeq grown = *t;
+    grown.mem = calloc((size_t)cap, SEQ_FRAME_BYTES);
+    if (!grown.mem) return 0;
+    seq_bind_columns(&grown, (uint8_t *)grown.mem, cap);
+    size_t n = (size_t)t->seqLen;
+    memcpy(grown.totalSamples, t->totalSamples, n * 4);
+    memcpy(grown.attack,       t->attack,       n * 4);
+    memcpy(grown.release,      t->release,      n * 4);
+    memcpy(grown.code,         t->code,         n * 4);
+    memcpy(grown.amplitude,    t->amplitude,    n * 4);
+    memcpy(grown.f1,           t->f1,           n * 2);
+    memcpy(grown.f2,           t->f2,           n * 2);
+    memcpy(grown.f3,           t->f3,           n * 2);
+    memcpy(grown.pitch,        t->pitch,        n * 2);
+    memcpy(grown.f0,           t->f0,           n * 2);
+    memcpy(grown.type,         t->type,         n);
+    memcpy(grown.flags,        t->flags,        n);
+    free(t->mem);
+    grown.capacity = cap;
+    *t = grown;
+    return 1;
+}
+
+static uint16_t quant_hz(double hz)
+{
+    if (hz <= 0.0) return 0;
+    if (hz >= 65535.0) return 65535;
+    return (uint16_t)hz;
+}
+
+/* append a silent frame of ts samples, returns its index or -1 */
+static int seq_push_silence(TTSSeq *t, int ts, uint32_t code)
+{
+    if (!seq_reserve(t, t->seqLen + 1)) return -1;
+    int i = t->seqLen++;
+    t->totalSamples[i] = ts;
+    t->attack[i] = t->release[i] = 0;
+    t->code[i] = code;  t->amplitude[i] = 0.0f;
+    t->f1[i] = t->f2[i] = t->f3[i] = 0;
+    t->pitch[i] = 0;  t->f0[i] = 0;
+    t->type[i] = vtype_silence;  t->flags[i] = 0;
+    return i;
+}
+
+/* append a frame built from a phoneme definition, returns its index or -1 */
+static int seq_push(TTSSeq *t, const PhonemeDef *pd,
+                    uint32_t code, double duration_override)
+{
+    if (!seq_reserve(t, t->seqLen + 1)) return -1;
+    int i = t->seqLen++;
 
     double dur = (duration_override > 0.0) ? duration_override : pd->duration;
-    d->totalSamples = (int)(dur * SAMPLE_RATE / READ_SPEED);
-    if (d->totalSamples < 2) d->totalSamples = 2;
+    int total = (int)(dur * t->sample_rate / READ_SPEED);
+    if (total < 2) total = 2;
 
-    /* calculate pitch with slight randomization for natural sound */
-    d->pitch = 90.0 + (double)(rand() % 41);
+    /* configure envelope windows */
+    int attack = (int)(total * 0.14);
+    if (attack < 3) attack = 3;
+    int release = (int)(total * 0.22);
     {
+        int min_rel = (int)(0.018 * t->sample_rate);
+        if (release < min_rel) release = min_rel;
+    }
+    if (release > total / 2) release = total / 2;
+    if (release < 2) release = 2;
+
+    t->totalSamples[i] = total;
+    t->attack[i]       = attack;
+    t->release[i]      = release;
+    t->code[i]         = code;
+    t->amplitude[i]    = (float)pd->amp;
+    t->f1[i] = quant_hz(pd->f1);  t->f2[i] = quant_hz(pd->f2);  t->f3[i] = quant_hz(pd->f3);
+    /* calculate pitch with slight randomization for natural sound */
+    t->pitch[i]        = (uint16_t)(90 + rng_next(&t->rng) % 41);
+    t->f0[i]           = 0;
+    t->type[i]         = (uint8_t)pd->type;
+    t->flags[i]        = pd->is_voiced ? FRAME_VOICED : 0;
+
+    if (t->xf && pd->type != vtype_silence) {
+        const VoiceRow *r = &t->xf->row[pd->type][pd->is_voiced != 0];
+        float amp = t->amplitude[i] * r->amp_scale;
+        t->amplitude[i] = amp > r->amp_max ? r->amp_max : amp;
+        t->f1[i] = quant_hz(pd->f1 * r->f_scale);
+        t->f2[i] = quant_hz(pd->f2 * r->f_scale);
+        t->f3[i] = quant_hz(pd->f3 * r->f_scale);
+        t->pitch[i] = quant_hz(t->pitch[i] * t->xf->pitch_scale + 0.5);
+        t->type[i]  = r->type;
+        t->flags[i] = (uint8_t)((t->flags[i] & ~r->flags_clear) | r->flags_set);
+    }
+    return i;
+}
+
+/* derive runtime filter state for frame i of the parameter stream */
+static void load_frame(FormantData *d, const TTSSeq *t, int i)
+{
+    memset(d, 0, sizeof(FormantData));
+    d->sampleRate   = t->sample_rate > 0 ? t->sample_rate : SAMPLE_RATE;
+    d->totalSamples = t->totalSamples[i];
+    d->type         = (PhType)t->type[i];
+    d->is_voiced    = (t->flags[i] & FRAME_VOICED) != 0;
+    d->is_whisper   = (t->flags[i] & FRAME_WHISPER) != 0;
+    d->amplitude    = t->amplitude[i];
+    d->f[0] = t->f1[i];  d->f[1] = t->f2[i];  d->f[2] = t->f3[i];
+    d->dbg_code     = t->code[i];
+    d->attack_samples  = t->attack[i];
+    d->release_samples = t->release[i];
+    if (d->type == vtype_silence) return;
+
+    d->pitch = t->pitch[i];
+    if (d->pitch > 0.0) {
         int max_h = (int)(d->sampleRate / (2.0 * d->pitch));
         if (max_h < 1) max_h = 1;
-        if (max_h > 40) max_h = 40;
+        if (max_h > KN_MAX_HARMONICS) max_h = KN_MAX_HARMONICS;
         double norm = 0.0;
         for (int h = 1; h <= max_h; h++) norm += 1.0 / (double)h;
         d->glottal_max_h = max_h;
         d->glottal_norm  = (norm > 0.0) ? norm : 1.0;
     }
 
-    d->phase_f0 = 0.0;  d->noise_hp = 0.0;
-    d->burstRemaining = (d->type == vtype_stop) ? (int)(0.018 * SAMPLE_RATE) : 0;
+    d->burstRemaining = (d->type == vtype_stop) ? (int)(0.018 * d->sampleRate) : 0;
 
-    /* configure envelope windows */
-    d->attack_samples  = (int)(d->totalSamples * 0.14);
-    if (d->attack_samples < 3) d->attack_samples = 3;
-    d->release_samples = (int)(d->totalSamples * 0.22);
-    {
-        int min_rel = (int)(0.018 * SAMPLE_RATE);
-        if (d->release_samples < min_rel) d->release_samples = min_rel;
-    }
-    if (d->release_samples > d->totalSamples / 2) d->release_samples = d->totalSamples / 2;
-    if (d->release_samples < 2) d->release_samples = 2;
+    /* white noise spreads over the whole band, at a higher rate less of it
+     * falls into a formant band; the pre-emphasis zero stays at the same
+     * frequency (~330 hz for fricatives, ~410 hz for bursts) */
+    double a16 = d->type == vtype_stop ? 0.85 : 0.88;
+    d->noise_gain = sqrt(d->sampleRate / SAMPLE_RATE);
+    d->noise_a    = pow(a16, SAMPLE_RATE / d->sampleRate);
+    double f_noise = 0.0;   /* main noise band, where the pre-emphasis gain is kept */
 
     double q_scale = d->pitch / 130.0;
     if (q_scale > 1.0) q_scale = 1.0;
     if (q_scale < 0.5) q_scale = 0.5;
 
     /* initialize specific filter configurations based on phoneme type */
-    if (d->type == vtype_vowel) {
-        init_bandpass(SAMPLE_RATE, d->f[0], 7.0*q_scale+1.0, &d->b0[0],&d->b1[0],&d->b2[0],&d->a1[0],&d->a2[0]);
-        init_bandpass(SAMPLE_RATE, d->f[1], 9.0*q_scale+1.0, &d->b0[1],&d->b1[1],&d->b2[1],&d->a1[1],&d->a2[1]);
-        init_bandpass(SAMPLE_RATE, d->f[2], 12.0*q_scale+1.0, &d->b0[2],&d->b1[2],&d->b2[2],&d->a1[2],&d->a2[2]);
+    if (d->is_whisper) {
+        /* whispered vowel: widened f1/f2 bands over noise */
+        double f1w = d->f[0] * 1.15;
+        double f2w = d->f[1] * 0.95;
+        if (f1w > 1200.0) f1w = 1200.0;
+        if (f2w > 3200.0) f2w = 3200.0;
+        if (f1w < 100.0)  f1w = 100.0;
+        if (f2w < 400.0)  f2w = 400.0;
+        f_noise = f1w;
+        voice_bandpass(d, 0, f1w, 2.5);
+        voice_bandpass(d, 1, f2w, 2.0);
+        init_lowpass(d->sampleRate, f2w * 1.25, &d->lp_b0,&d->lp_b1,&d->lp_b2,&d->lp_a1,&d->lp_a2);
+    } else if (d->type == vtype_vowel) {
+        voice_bandpass(d, 0, d->f[0], 7.0*q_scale+1.0);
+        voice_bandpass(d, 1, d->f[1], 9.0*q_scale+1.0);
+        voice_bandpass(d, 2, d->f[2], 12.0*q_scale+1.0);
     } else if (d->type == vtype_fricative) {
         double fc1 = (d->f[0] > 0.0) ? d->f[0] : 3000.0;
         double fc2 = (d->f[1] > 0.0) ? d->f[1] : fc1 * 1.3;
-        init_bandpass(SAMPLE_RATE, fc1, 2.5, &d->b0[0],&d->b1[0],&d->b2[0],&d->a1[0],&d->a2[0]);
-        init_bandpass(SAMPLE_RATE, fc2, 2.0, &d->b0[1],&d->b1[1],&d->b2[1],&d->a1[1],&d->a2[1]);
+        f_noise = fc1;
+        voice_bandpass(d, 0, fc1, 2.5);
+        voice_bandpass(d, 1, fc2, 2.0);
         double lp_fc = fc1 < 3500.0 ? fc1 * 0.80 : 2800.0;
-        init_lowpass(SAMPLE_RATE, lp_fc, &d->lp_b0,&d->lp_b1,&d->lp_b2,&d->lp_a1,&d->lp_a2);
+        init_lowpass(d->sampleRate, lp_fc, &d->lp_b0,&d->lp_b1,&d->lp_b2,&d->lp_a1,&d->lp_a2);
     } else if (d->type == vtype_consonant) {
         double fc1 = (d->f[0] > 0.0) ? d->f[0] : 400.0;
         double fc2 = (d->f[1] > 0.0) ? d->f[1] : 1200.0;
-        init_bandpass(SAMPLE_RATE, fc1, 5.0*q_scale+1.0, &d->b0[0],&d->b1[0],&d->b2[0],&d->a1[0],&d->a2[0]);
-        init_bandpass(SAMPLE_RATE, fc2, 6.0*q_scale+1.0, &d->b0[1],&d->b1[1],&d->b2[1],&d->a1[1],&d->a2[1]);
-        init_lowpass(SAMPLE_RATE, 3000.0, &d->lp_b0,&d->lp_b1,&d->lp_b2,&d->lp_a1,&d->lp_a2);
+        voice_bandpass(d, 0, fc1, 5.0*q_scale+1.0);
+        voice_bandpass(d, 1, fc2, 6.0*q_scale+1.0);
+        init_lowpass(d->sampleRate, 3000.0, &d->lp_b0,&d->lp_b1,&d->lp_b2,&d->lp_a1,&d->lp_a2);
     } else if (d->type == vtype_stop) {
         double fc1 = (d->f[0] > 0.0) ? d->f[0] : 600.0;
         double fc2 = (d->f[1] > 0.0) ? d->f[1] : 1800.0;
-        init_bandpass(SAMPLE_RATE, fc1, 3.5, &d->b0[0],&d->b1[0],&d->b2[0],&d->a1[0],&d->a2[0]);
-        init_bandpass(SAMPLE_RATE, fc2, 3.0, &d->b0[1],&d->b1[1],&d->b2[1],&d->a1[1],&d->a2[1]);
-        init_lowpass(SAMPLE_RATE, 2500.0, &d->lp_b0,&d->lp_b1,&d->lp_b2,&d->lp_a1,&d->lp_a2);
+        f_noise = fc1;
+        voice_bandpass(d, 0, fc1, 3.5);
+        voice_bandpass(d, 1, fc2, 3.0);
+        init_lowpass(d->sampleRate, 2500.0, &d->lp_b0,&d->lp_b1,&d->lp_b2,&d->lp_a1,&d->lp_a2);
+    }
+
+    /* the one-zero pre-emphasis cannot keep its whole response across
+     * rates, match its gain in the band the noise is filtered to */
+    if (f_noise > 0.0 && d->sampleRate != SAMPLE_RATE) {
+        double fn = f_noise < 0.49 * d->sampleRate ? f_noise : 0.49 * d->sampleRate;
+        d->noise_gain *= preemph_gain(a16, fn < 0.49 * SAMPLE_RATE ? fn : 0.49 * SAMPLE_RATE, SAMPLE_RATE)
+                       / preemph_gain(d->noise_a, fn, d->sampleRate);
     }
 }
 
@@ -238,12 +564,12 @@ static void setup_formant(FormantData *d, PhonemeDef *pd,
 static float generate_sample(TTSSeq *tts)
 {
     if (!tts || tts->currentIndex >= tts->seqLen) return 0.0f;
-    FormantData *d = &tts->seq[tts->currentIndex];
+    FormantData *d = &tts->voice;
 
     while (d->currentSample >= d->totalSamples) {
         tts->currentIndex++;
         if (tts->currentIndex >= tts->seqLen) return 0.0f;
-        d = &tts->seq[tts->currentIndex];
+        load_frame(d, tts, tts->currentIndex);
     }
 
     double env = envelope_amp(d);
@@ -260,15 +586,15 @@ static float generate_sample(TTSSeq *tts)
     } else if (d->type == vtype_consonant) {
         double src;
         if (d->is_voiced)
-            src = glottal_source(d)*0.55 + ((double)rand()/(double)RAND_MAX*2.0-1.0)*0.02;
+            src = glottal_source(d)*0.55 + rng_white(&tts->rng)*0.02*d->noise_gain;
         else
-            src = ((double)rand()/(double)RAND_MAX*2.0-1.0)*0.10;
+            src = rng_white(&tts->rng)*0.10*d->noise_gain;
         double y0 = apply_biquad(d, 0, src);
         double y1 = apply_biquad(d, 1, src);
         s = apply_lp(d, y0*0.6 + y1*0.4) * d->amplitude * env;
     } else if (d->type == vtype_fricative) {
-        double n = ((double)rand()/(double)RAND_MAX*2.0-1.0);
-        double hp = n - 0.88*d->noise_hp; d->noise_hp = n;
+        double n = rng_white(&tts->rng) * d->noise_gain;
+        double hp = n - d->noise_a*d->noise_hp; d->noise_hp = n;
         double y0 = apply_biquad(d, 0, hp);
         double y1 = apply_biquad(d, 1, hp);
         double mix = y0*0.6 + y1*0.4;
@@ -276,8 +602,8 @@ static float generate_sample(TTSSeq *tts)
         s = apply_lp(d, mix) * d->amplitude * env;
     } else if (d->type == vtype_stop) {
         if (d->burstRemaining > 0) {
-            double noise = ((double)rand()/(double)RAND_MAX*2.0-1.0);
-            double n_hp = noise - 0.85*d->noise_hp; d->noise_hp = noise;
+            double noise = rng_white(&tts->rng) * d->noise_gain;
+            double n_hp = noise - d->noise_a*d->noise_hp; d->noise_hp = noise;
             double y0 = apply_biquad(d, 0, n_hp);
             double y1 = apply_biquad(d, 1, n_hp);
             double benv = (double)d->burstRemaining / (0.018 * d->sampleRate);
@@ -297,19 +623,14 @@ static float generate_sample(TTSSeq *tts)
 static void reset_seq(TTSSeq *tts)
 {
     tts->currentIndex = 0;
-    for (int i = 0; i < tts->seqLen; i++) {
-        FormantData *d = &tts->seq[i];
-        d->currentSample = 0; d->phase_f0 = 0.0; d->noise_hp = 0.0;
-        d->lp_x1 = d->lp_x2 = d->lp_y1 = d->lp_y2 = 0.0;
-        d->burstRemaining = (d->type == vtype_stop) ? (int)(0.018*SAMPLE_RATE) : 0;
-        for (int j = 0; j < 3; j++) d->x1[j]=d->x2[j]=d->y1[j]=d->y2[j]=0.0;
-    }
+    if (tts->seqLen > 0) load_frame(&tts->voice, tts, 0);
+    else memset(&tts->voice, 0, sizeof(tts->voice));
 }
 
 /* free memory allocated for tts sequence */
 static void free_tts(TTSSeq *t)
 {
     if (!t) return;
-    if (t->seq) free(t->seq);
+    if (t->mem) free(t->mem);
     free(t);
 }
@@ -0,0 +1,265 @@
+#pragma once
+
+/* time-scale and pitch modification of a rendered buffer
+ * wsola stretches the input by pitch / speed, then a polyphase sinc
+ * kernel (tts_resample.h) reads the stretched signal at step pitch.
+ * tempo follows speed only and pitch follows pitch only. both can change between
+ * blocks without restarting; the work per output block is bounded by
+ * TSM_MAX_PITCH (at most two wsola frames per 128 samples at 16 khz).
+ * the input is read in place and must stay valid while the state is used;
+ * it may also grow while playing (tsm_extend), output then pauses
+ * whenever the engine would need samples that have not arrived yet.
+ */
+
+#include "tts_resample.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define TSM_MAX_WIN    1024   /* analysis window, enough for 48 khz */
+#define TSM_Y_LEN      4096   /* stretched samples waiting for the resampler */
+#define TSM_MIN_SPEED  0.25f
+#define TSM_MAX_SPEED  4.0f
+#define TSM_MIN_PITCH  0.5f
+#define TSM_MAX_PITCH  2.0f
+
+typedef struct {
+    const float *in;
+    int     in_len;
+    float   speed, pitch;
+    int     hop, win, tol;       /* synthesis hop, window (2 * hop), search range */
+    double  a_pos;               /* nominal input position of the next frame */
+    int     prev;                /* input start of the previous frame */
+    int     final;               /* in_len is the whole input */
+    int     primed;              /* lead-in frame added */
+    int     ended;               /* last frame flushed */
+    float   window[TSM_MAX_WIN]; /* periodic hann, sums to 1 at 50% overlap */
+    float   ola[TSM_MAX_WIN];    /* overlap-add accumulator */
+    float   y[TSM_Y_LEN];        /* stretched signal */
+    int     y_len;
+    double  r_pos;               /* resampler read position in y */
+    double  t_in;                /* input time reached by the output, in samples */
+    RSKernel rs;                 /* resampler rows for the current pitch */
+} TSMState;
+
+static inline float tsm_in(const TSMState *s, int i)
+{
+    return (i >= 0 && i < s->in_len) ? s->in[i] : 0.0f;
+}
+
+static inline float tsm_y(const TSMState *s, int i)
+{
+    return (i >= 0 && i < s->y_len) ? s->y[i] : 0.0f;
+}
+
+static inline float tsm_clampf(float v, float lo, float hi)
+{
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static inline void tsm_set_params(TSMState *s, float speed, float pitch)
+{
+    s->speed = tsm_clampf(speed > 0.0f ? speed : 1.0f, TSM_MIN_SPEED, TSM_MAX_SPEED);
+    s->pitch = tsm_clampf(pitch > 0.0f ? pitch : 1.0f, TSM_MIN_PITCH, TSM_MAX_PITCH);
+}
+
+/* expected output length for a buffer of len samples */
+static inline int tsm_length(int len, float speed)
+{
+    speed = tsm_clampf(speed > 0.0f ? speed : 1.0f, TSM_MIN_SPEED, TSM_MAX_SPEED);
+    return (int)((double)len / speed + 0.5);
+}
+
+static inline void tsm_init(TSMState *s, const float *in, int len, int sample_rate)
+{
+    int hop = (sample_rate / 84) & ~1;            /* ~12 ms */
+    if (hop < 32) hop = 32;
+    if (hop > TSM_MAX_WIN / 2) hop = TSM_MAX_WIN / 2;
+
+    s->in     = in;
+    s->in_len = len > 0 ? len : 0;
+    s->hop    = hop;
+    s->win    = hop * 2;
+    s->tol    = (hop * 2) / 3;                    /* half a period at ~60 hz */
+    s->a_pos  = 0.0;
+    s->final  = 1;
+    s->primed = 0;
+    s->ended  = 0;
+    s->y_len  = 0;
+    s->r_pos  = 0.0;
+    s->t_in   = 0.0;
+    tsm_set_params(s, 1.0f, 1.0f);
+
+    for (int i = 0; i < s->win; i++)
+        s->window[i] = 0.5f - 0.5f * (float)cos(2.0 * M_PI * i / s->win);
+    memset(s->ola, 0, sizeof(s->ola));
+
+    s->rs.cut = 0.0f;
+    rs_set_step(&s->rs, 1.0f);
+    s->prev = -hop;
+}
+
+/* streaming input: the first len samples are valid now, final once complete */
+static inline void tsm_extend(TSMState *s, int len, int final)
+{
+    if (len > s->in_len) s->in_len = len;
+    s->final = final ? 1 : 0;
+}
+
+/* whether the input the next frame may touch has arrived */
+static inline int tsm_ready(const TSMState *s)
+{
+    if (s->final) return 1;
+    int nom = (int)floor(s->a_pos + 0.5);
+    int end = nom + s->tol;
+    if (s->prev + s->hop > end) end = s->prev + s->hop;
+    return end + s->win <= s->in_len;
+}
+
+/* the frame before the start holds the second half of the window,
+ * so the first output samples come out at full gain */
+static inline void tsm_prime(TSMState *s)
+{
+    int at = s->prev + s->hop;
+    for (int j = 0; j < s->hop; j++) s->ola[j] = s->window[s->hop + j] * tsm_in(s, at + j);
+    s->primed = 1;
+}
+
+/* restart at input sample pos as though the input began there. nothing
+ * before pos is processed, so the cost does not depend on pos */
+static inline void tsm_seek(TSMState *s, int pos)
+{
+    if (pos < 0) pos = 0;
+    if (s->final && pos > s->in_len) pos = s->in_len;
+    s->a_pos  = (double)pos;
+    s->prev   = pos - s->hop;
+    s->primed = 0;
+    s->ended  = 0;
+    s->y_len  = 0;
+    s->r_pos  = 0.0;
+    s->t_in   = (double)pos;
+    memset(s->ola, 0, sizeof(s->ola));
+}
+
+/* all output for a complete input has been produced */
+static inline int tsm_done(const TSMState *s)
+{
+    return s->final && (s->t_in >= (double)s->in_len || (s->ended && s->r_pos >= (double)s->y_len));
+}
+
+/* normalised correlation of the overlap region of a candidate frame
+ * against the natural continuation of the previous one */
+static inline float tsm_score(const TSMState *s, int ref, int cand)
+{
+    float xy = 0.0f, yy = 1e-9f;
+    for (int j = 0; j < s->hop; j++) {
+        float a = tsm_in(s, ref + j), b = tsm_in(s, cand + j);
+        xy += a * b;
+        yy += b * b;
+    }
+    return xy / sqrtf(yy);
+}
+
+/* add one wsola frame, appends hop samples to y */
+static inline void tsm_frame(TSMState *s)
+{
+    int hop = s->hop, win = s->win;
+    int ref = s->prev + hop;
+    int nom = (int)floor(s->a_pos + 0.5);
+    int lo = nom - s->tol, hi = nom + s->tol;
+    if (lo < 0) lo = 0;
+    if (hi < lo) hi = lo;
+
+    /* when the nominal frame is the natural continuation (speed == pitch)
+     * it is the best match by construction; otherwise search coarse on
+     * even offsets and refine around the best */
+    int best = (ref >= lo && ref <= hi) ? ref : nom;
+    if (best < lo) best = lo;
+    if (ref != nom) {
+        float best_sc = tsm_score(s, ref, best);
+        for (int c = lo; c <= hi; c += 2) {
+            float sc = tsm_score(s, ref, c);
+            if (sc > best_sc) { best_sc = sc; best = c; }
+        }
+        for (int c = best - 1; c <= best + 1; c += 2) {
+            if (c < lo || c > hi) continue;
+            float sc = tsm_score(s, ref, c);
+            if (sc > best_sc) { best_sc = sc; best = c; }
+        }
+    }
+
+    for (int j = 0; j < win; j++) s->ola[j] += s->window[j] * tsm_in(s, best + j);
+    memcpy(s->y + s->y_len, s->ola, (size_t)hop * sizeof(float));
+    s->y_len += hop;
+    memmove(s->ola, s->ola + hop, (size_t)(win - hop) * sizeof(float));
+    memset(s->ola + (win - hop), 0, (size_t)hop * sizeof(float));
+
+    s->prev   = best;
+    s->a_pos += (double)hop * s->speed / s->pitch;
+}
+
+/* windowed-sinc read of y at t through the polyphase kernel, the edges
+ * of y read zeros */
+static inline float tsm_read(const TSMState *s, double t)
+{
+    int   base = (int)floor(t);
+    float frac = (float)(t - base);
+    const RSKernel *k = &s->rs;
+    if (frac == 0.0f && k->cut == 1.0f) return tsm_y(s, base);
+    int lo = base + 1 - k->half;
+    if (lo >= 0 && lo + k->taps <= s->y_len) return rs_read(k, s->y + base, frac);
+    float tmp[RS_MAX_TAPS];
+    for (int j = 0; j < k->taps; j++) tmp[j] = tsm_y(s, lo + j);
+    return rs_read(k, tmp + k->half - 1, frac);
+}
+
+/* input sample the output has reached, for progress display */
+static inline int tsm_position(const TSMState *s)
+{
+    return s->t_in < (double)s->in_len ? (int)s->t_in : s->in_len;
+}
+
+/* produce up to n output samples, returns fewer once the input is used up
+ * (tsm_done) or when growing input has not arrived yet */
+static inline int tsm_process(TSMState *s, float *out, int n)
+{
+    /* furthest tap, padding included, at the lowest cutoff */
+    int kmax = RS_MAX_TAPS - RS_MAX_HALF + 3;
+    int produced = 0;
+    rs_set_step(&s->rs, s->pitch);
+    while (produced < n) {
+        int need = (int)floor(s->r_pos) + kmax;
+        while (!s->ended && s->y_len <= need) {
+            if (s->y_len + s->hop > TSM_Y_LEN) {
+                /* drop samples the resampler no longer reaches */
+                int drop = (int)floor(s->r_pos) - kmax;
+                if (drop <= 0) break;
+                memmove(s->y, s->y + drop, (size_t)(s->y_len - drop) * sizeof(float));
+                s->y_len -= drop;
+                s->r_pos -= drop;
+                need     -= drop;
+                continue;
+            }
+            if (!tsm_ready(s)) return produced;
+            if (!s->primed) tsm_prime(s);
+            if (s->a_pos < (double)s->in_len) {
+                tsm_frame(s);
+            } else {
+                /* flush the tail of the last frame */
+                memcpy(s->y + s->y_len, s->ola, (size_t)s->hop * sizeof(float));
+                s->y_len += s->hop;
+                s->ended = 1;
+            }
+        }
+        if (tsm_done(s)) break;
+        out[produced++] = tsm_read(s, s->r_pos);
+        s->r_pos += s->pitch;
+        s->t_in  += s->speed;
+    }
+    return produced;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+/* streaming wav writer
+ * a 44 byte header (riff, fmt, data) goes first with the sizes left open,
+ * pcm follows block by block and the sizes are filled in at the end, so a
+ * writer never holds more than one block. mono; float (format 3), 16 bit
+ * pcm (format 1) or mu-law (format 7). the formats number like the engine's
+ * output formats (TTS_FMT_*, KSE_FMT_*).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define WAV_HEADER_BYTES 44
+
+enum {
+    WAV_F32  = 0,
+    WAV_S16  = 1,
+    WAV_ULAW = 2
+};
+
+static inline int wav_sample_bytes(int fmt)
+{
+    return fmt == WAV_S16 ? 2 : (fmt == WAV_ULAW ? 1 : 4);
+}
+
+static inline void wav_put16(uint8_t *p, uint32_t v) { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); }
+static inline void wav_put32(uint8_t *p, uint32_t v) { wav_put16(p, v); wav_put16(p + 2, v >> 16); }
+
+/* header for data_bytes of pcm; 0xFFFFFFFF marks a length still unknown,
+ * which most readers take as "until the end of the file" */
+static void wav_header(uint8_t *h, int fmt, int rate, uint32_t data_bytes)
+{
+    int bytes = wav_sample_bytes(fmt);
+    uint32_t riff = data_bytes > 0xFFFFFFFFu - 36 ? 0xFFFFFFFFu : data_bytes + 36;
+    memcpy(h, "RIFF", 4);       wav_put32(h + 4, riff);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    wav_put32(h + 16, 16);
+    wav_put16(h + 20, fmt == WAV_S16 ? 1 : (fmt == WAV_ULAW ? 7 : 3));
+    wav_put16(h + 22, 1);                         /* channels */
+    wav_put32(h + 24, (uint32_t)rate);
+    wav_put32(h + 28, (uint32_t)(rate * bytes));  /* byte rate */
+    wav_put16(h + 32, (uint32_t)bytes);           /* block align */
+    wav_put16(h + 34, (uint32_t)(bytes * 8));
+    memcpy(h + 36, "data", 4);  wav_put32(h + 40, data_bytes);
+}
+
+#ifndef __EMSCRIPTEN__
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* buffered file sink, writes reach the file WAV_FILE_BUF bytes at a time */
+#define WAV_FILE_BUF (1 << 18)
+
+typedef struct {
+    int      fd;
+    int      fmt, rate;
+    uint64_t data_bytes;
+    int      len;      /* bytes waiting in buf */
+    int      err;
+    uint8_t  buf[WAV_FILE_BUF];
+} WavFile;
+
+static int wav_flush(WavFile *w)
+{
+    const uint8_t *p = w->buf;
+    int left = w->len;
+    while (left > 0 && !w->err) {
+        ssize_t n = write(w->fd, p, (size_t)left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) { w->err = 1; break; }
+        p += n; left -= (int)n;
+    }
+    w->len = 0;
+    return !w->err;
+}
+
+/* create path (truncating it) and start a wav of format fmt. "-" writes to
+ * stdout, its sizes then stay open */
+static int wav_open(WavFile *w, const char *path, int fmt, int rate)
+{
+    memset(w, 0, offsetof(WavFile, buf));
+    w->fd = strcmp(path, "-") ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : 1;
+    if (w->fd < 0) return 0;
+    w->fmt  = fmt;
+    w->rate = rate;
+    wav_header(w->buf, fmt, rate, 0xFFFFFFFFu);
+    w->len = WAV_HEADER_BYTES;
+    return 1;
+}
+
+/* append samples already in the file's format, little-endian */
+static int wav_write_raw(WavFile *w, const void *pcm, int bytes)
+{
+    const uint8_t *p = (const uint8_t *)pcm;
+    w->data_bytes += (uint64_t)bytes;
+    while (bytes > 0 && !w->err) {
+        int m = WAV_FILE_BUF - w->len < bytes ? WAV_FILE_BUF - w->len : bytes;
+        memcpy(w->buf + w->len, p, (size_t)m);
+        w->len += m; p += m; bytes -= m;
+        if (w->len == WAV_FILE_BUF) wav_flush(w);
+    }
+    return !w->err;
+}
+
+/* flush, fill in the sizes if the file can seek, close. returns 1 if every
+ * byte was written */
+static int wav_close(WavFile *w)
+{
+    wav_flush(w);
+    if (!w->err && lseek(w->fd, 0, SEEK_SET) == 0) {
+        uint8_t h[WAV_HEADER_BYTES];
+        wav_header(h, w->fmt, w->rate, w->data_bytes > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)w->data_bytes);
+        if (write(w->fd, h, sizeof(h)) != (ssize_t)sizeof(h)) w->err = 1;
+    }
+    if (w->fd != 1 && close(w->fd) != 0) w->err = 1;
+    return !w->err;
+}
+#endif
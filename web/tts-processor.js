@@ -1,56 +1,174 @@
-// tts processor realtime resampler
+// tts processor realtime time-scale and pitch modification
+
+// shared ring header slots (int32), see tts-worker.js
+const RING_WRITE     = 0;
+const RING_READ      = 1;
+const RING_GEN       = 2;
+const RING_DONE      = 3;
+const RING_TOTAL     = 4;
+const RING_UNDERRUNS = 5;
+const RING_MIN_FILL  = 6;
+const RING_HEADER    = 32;
+const RING_FEED      = 4096;  // input kept ahead of the engine
+
 class TTSProcessor extends AudioWorkletProcessor {
-    constructor() {
+    constructor(options) {
         super();
-        this._buf      = null;   // raw samples
-        this._pos      = 0.0;    // fractional read position
+        this._buf      = null;   // raw samples (fallback path only)
+        this._pos      = 0.0;    // fractional read position (fallback path only)
         this._pitch    = 1.0;    // pitch ratio (pitchhz / 105)
         this._speed    = 1.0;    // speed multiplier
         this._playing  = false;  // playing flag
+        this._dsp      = null;   // tts-dsp.wasm exports when available
+        this._useDsp   = false;  // current buffer plays through the engine
+        this._ring     = null;   // streaming source shared with the worker
+        this._queue    = [];     // sentences waiting behind the current buffer
+        this._final    = true;   // no more sentences will be appended
+        this._tl       = null;   // phone runs of the current buffer, four int32 each
+        this._tlAmp    = null;   // the same runs as float32, for the amplitude
+        this._tlAt     = -1;     // run last reported
+
+        // wsola + sinc engine compiled from src/tts-dsp.c
+        const mod = options && options.processorOptions && options.processorOptions.dsp;
+        if (mod) {
+            try {
+                this._dsp = this._instantiate(mod);
+            } catch (e) {
+                this._dsp = null;
+            }
+        }
 
         this.port.onmessage = (e) => {
             const d = e.data;
             if (d.type === 'load') {
-                // load buffer and start
-                this._buf     = d.buf;
-                this._pos     = 0.0;
+                // load buffer and start, more sentences follow as 'append' when d.more
                 this._pitch   = d.pitch;
                 this._speed   = d.speed;
+                this._ring    = null;
+                this._queue   = [];
+                this._final   = !d.more;
+                this._next(d.buf, d.tl);
                 this._playing = true;
+            } else if (d.type === 'append') {
+                // next sentence of the utterance, played straight after the current one
+                this._queue.push({ buf: d.buf, tl: d.tl });
+                this._final = !!d.last;
+            } else if (d.type === 'ring') {
+                // stream from the worker, starts once it publishes this utterance
+                this._pitch   = d.pitch;
+                this._speed   = d.speed;
+                this._buf     = null;
+                this._useDsp  = false;
+                this._setTimeline(null);
+                this._ring    = this._ringRun(new Int32Array(d.sab, 0, 8),
+                                              new Float32Array(d.sab, RING_HEADER, d.capacity), d.gen, 0);
+                this._playing = true;
+            } else if (d.type === 'timeline') {
+                // phone runs of the streamed utterance, known once the worker has built it
+                if (this._ring && this._ring.gen === d.gen) this._setTimeline(d.tl);
+            } else if (d.type === 'seek') {
+                // continue from input sample d.pos; a streamed utterance starts a
+                // new ring run (d.gen) that the worker fills from there
+                if (this._ring) this._ring = this._ringRun(this._ring.hdr, this._ring.data, d.gen, d.pos);
+                else if (this._useDsp) this._dsp.dsp_seek(d.pos);
+                else if (this._buf) this._pos = Math.min(d.pos, this._buf.length);
+                this._tlAt = -1;
             } else if (d.type === 'params') {
                 // update params
                 this._pitch = d.pitch;
                 this._speed = d.speed;
+                if (this._useDsp) this._dsp.dsp_params(this._speed, this._pitch);
             } else if (d.type === 'stop') {
                 // stop and clear
                 this._playing = false;
                 this._buf = null;
+                this._useDsp = false;
+                this._ring = null;
+                this._queue = [];
+                this._setTimeline(null);
             }
         };
     }
 
-    process(inputs, outputs) {
-        const out = outputs[0][0];
-        if (!out) return true;
+    _ringRun(hdr, data, gen, from) {
+        return {
+            hdr:     hdr,
+            data:    data,
+            gen:     gen,
+            from:    from,    // utterance sample the run starts at
+            started: false,   // engine set up for this run
+            audible: false,   // first samples played, underruns count from here
+            fed:     0,       // samples moved into the engine
+            inPtr:   0        // engine input storage
+        };
+    }
 
-        // output silence when not playing
-        if (!this._playing || !this._buf) {
-            out.fill(0);
-            return true;
+    _instantiate(mod) {
+        // standalone wasm, stub whatever the runtime imports
+        const imports = {};
+        for (const imp of WebAssembly.Module.imports(mod)) {
+            if (imp.kind !== 'function') continue;
+            if (!imports[imp.module]) imports[imp.module] = {};
+            imports[imp.module][imp.name] = () => 0;
         }
+        const ex = new WebAssembly.Instance(mod, imports).exports;
+        if (ex._initialize) ex._initialize();
+        return ex;
+    }
 
+    _next(buf, tl) {
+        // make buf the current buffer, each sentence restarts the engine
+        this._pos    = 0.0;
+        this._useDsp = !!this._dsp && this._dspLoad(buf);
+        this._buf    = this._useDsp ? null : buf;
+        this._setTimeline(tl);
+    }
+
+    _setTimeline(tl) {
+        this._tl    = tl || null;
+        this._tlAmp = tl ? new Float32Array(tl.buffer, tl.byteOffset, tl.length) : null;
+        this._tlAt  = -1;
+    }
+
+    _phone(pos) {
+        // report the phone at input sample pos whenever it changes, so the
+        // page follows what is audible rather than a timer of its own
+        const tl = this._tl;
+        if (!tl) return;
+        const runs = tl.length >> 2;
+        let k = Math.max(0, this._tlAt);
+        while (k + 1 < runs && tl[(k + 1) * 4] <= pos) k++;
+        if (k === this._tlAt) return;
+        this._tlAt = k;
+        this.port.postMessage({
+            type:  'phone',
+            start: tl[k * 4],
+            code:  tl[k * 4 + 1] >>> 0,
+            kind:  tl[k * 4 + 2],
+            amp:   this._tlAmp[k * 4 + 3]
+        });
+    }
+
+    _fill(out, i) {
+        // play the current buffer into out from i, returns where it stopped
+        if (this._useDsp) {
+            const dsp = this._dsp;
+            const got = dsp.dsp_process(out.length - i);
+            if (got > 0) out.set(new Float32Array(dsp.memory.buffer, dsp.dsp_out(), got), i);
+            if (i + got < out.length) this._useDsp = false;
+            return i + got;
+        }
+        if (!this._buf) return i;
+
+        // fallback without the engine: linear resampling, pitch also changes tempo
         const buf  = this._buf;
         const len  = buf.length;
         const step = this._speed * this._pitch;   // advance step
 
-        // linear interpolation resampling
-        for (let i = 0; i < out.length; i++) {
+        for (; i < out.length; i++) {
             if (this._pos >= len - 1) {
-                // finish and signal end
-                for (let j = i; j < out.length; j++) out[j] = 0;
-                this._playing = false;
-                this.port.postMessage({ type: 'ended' });
-                return true;
+                this._buf = null;
+                return i;
             }
 
             const lo  = Math.floor(this._pos);
@@ -59,6 +177,136 @@ class TTSProcessor extends AudioWorkletProcessor {
             out[i]    = buf[lo] * (1 - t) + buf[hi] * t;
             this._pos += step;
         }
+        return i;
+    }
+
+    _dspLoad(buf) {
+        // copy samples into the engine and start it
+        const dsp = this._dsp;
+        const ptr = dsp.dsp_alloc(buf.length);
+        if (!ptr) return false;
+        new Float32Array(dsp.memory.buffer, ptr, buf.length).set(buf);
+        if (!dsp.dsp_start(buf.length, sampleRate)) return false;
+        dsp.dsp_params(this._speed, this._pitch);
+        return true;
+    }
+
+    _ringProcess(out) {
+        // read the shared ring, through the engine when it is loaded
+        const ring = this._ring;
+        const hdr  = ring.hdr;
+        if (Atomics.load(hdr, RING_GEN) !== ring.gen) {
+            out.fill(0);
+            return;
+        }
+
+        const cap  = ring.data.length;
+        const mask = cap - 1;
+        const done = Atomics.load(hdr, RING_DONE) === 1;
+        const r    = Atomics.load(hdr, RING_READ);
+        const fill = Atomics.load(hdr, RING_WRITE) - r;
+        if (ring.audible && fill < Atomics.load(hdr, RING_MIN_FILL)) Atomics.store(hdr, RING_MIN_FILL, fill);
+
+        const dsp = this._dsp;
+        let got;
+        if (dsp) {
+            if (!ring.started) {
+                ring.inPtr = dsp.dsp_alloc(Math.max(1, Atomics.load(hdr, RING_TOTAL)));
+                if (!ring.inPtr || !dsp.dsp_start_stream(sampleRate)) {
+                    this._ring = null;
+                    this._end(out, 0);
+                    return;
+                }
+                dsp.dsp_params(this._speed, this._pitch);
+                ring.started = true;
+            }
+
+            // move just enough input into the engine, the rest stays in the ring
+            const ahead = ring.fed - dsp.dsp_position();
+            const take  = Math.min(fill, Math.max(0, RING_FEED - ahead));
+            if (take > 0) {
+                const at    = r & mask;
+                const first = Math.min(take, cap - at);
+                const heap  = new Float32Array(dsp.memory.buffer);
+                const dst   = (ring.inPtr >> 2) + ring.fed;
+                heap.set(ring.data.subarray(at, at + first), dst);
+                if (first < take) heap.set(ring.data.subarray(0, take - first), dst + first);
+                ring.fed += take;
+                Atomics.store(hdr, RING_READ, r + take);
+                Atomics.notify(hdr, RING_READ);
+            }
+            dsp.dsp_extend(ring.fed, done && take === fill ? 1 : 0);
+
+            got = dsp.dsp_process(out.length);
+            if (got > 0) out.set(new Float32Array(dsp.memory.buffer, dsp.dsp_out(), got));
+            this._phone(ring.from + dsp.dsp_position());
+            if (got < out.length && dsp.dsp_done()) {
+                this._ring = null;
+                this._end(out, got);
+                return;
+            }
+        } else {
+            // no engine: play the ring as is
+            got = Math.min(fill, out.length);
+            const at    = r & mask;
+            const first = Math.min(got, cap - at);
+            out.set(ring.data.subarray(at, at + first));
+            if (first < got) out.set(ring.data.subarray(0, got - first), first);
+            Atomics.store(hdr, RING_READ, r + got);
+            Atomics.notify(hdr, RING_READ);
+            this._phone(ring.from + r + got);
+            if (got < out.length && done && got === fill) {
+                this._ring = null;
+                this._end(out, got);
+                return;
+            }
+        }
+
+        if (got > 0) ring.audible = true;
+        if (got < out.length) {
+            for (let j = got; j < out.length; j++) out[j] = 0;
+            if (ring.audible) Atomics.add(hdr, RING_UNDERRUNS, 1);
+        }
+    }
+
+    _end(out, from) {
+        // finish and signal end
+        for (let j = from; j < out.length; j++) out[j] = 0;
+        this._playing = false;
+        this.port.postMessage({ type: 'ended' });
+    }
+
+    process(inputs, outputs) {
+        const out = outputs[0][0];
+        if (!out) return true;
+
+        // output silence when not playing
+        if (!this._playing) {
+            out.fill(0);
+            return true;
+        }
+
+        if (this._ring) {
+            this._ringProcess(out);
+            return true;
+        }
+
+        // current buffer, then the queued sentences in order
+        let i = this._fill(out, 0);
+        while (i < out.length && this._queue.length) {
+            const q = this._queue.shift();
+            this._next(q.buf, q.tl);
+            i = this._fill(out, i);
+        }
+        this._phone(this._useDsp ? this._dsp.dsp_position() : this._pos);
+        if (i < out.length) {
+            if (this._final) {
+                this._end(out, i);
+                return true;
+            }
+            // next sentence still rendering
+            for (let j = i; j < out.length; j++) out[j] = 0;
+        }
 
         return true;
     }
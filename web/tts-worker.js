@@ -0,0 +1,146 @@
+// tts synthesis worker
+// streams rendered blocks into a shared ring read by the worklet, or renders
+// whole sentences for the wrapper's worker pool
+// the wrapper names the engine build to load (see TTSWrapper.moduleVariants)
+importScripts(new URL(self.location.href).searchParams.get('module') || 'tts.js');
+
+// ring layout, shared with tts-wrapper.js and tts-processor.js
+const RING_WRITE     = 0;   // samples written (producer)
+const RING_READ      = 1;   // samples read (consumer)
+const RING_GEN       = 2;   // utterance the ring currently holds
+const RING_DONE      = 3;   // producer finished RING_GEN
+const RING_TOTAL     = 4;   // utterance length in samples
+const RING_UNDERRUNS = 5;   // blocks the consumer could not fill
+const RING_MIN_FILL  = 6;   // lowest fill level seen while playing
+const RING_CANCEL    = 7;   // utterance the main thread wants, others stop
+const RING_HEADER    = 32;  // header bytes before the sample data
+
+const BLOCK = 1024;         // samples per render call
+
+let mod      = null;
+let hdr      = null;
+let data     = null;
+let blockPtr = 0;
+let cur      = null;        // last streamed utterance: total, whole copy, contiguous samples rendered
+let queue    = TTSModule().then((m) => {
+    mod      = m;
+    blockPtr = mod._malloc(BLOCK * 4);
+    postMessage({ type: 'ready' });
+});
+
+function allocString(str) {
+    // allocate and copy string to wasm heap
+    const encoded = new TextEncoder().encode(str);
+    const ptr     = mod._malloc(encoded.length + 1);
+    if (!ptr) return 0;
+    const heap = new Uint8Array(mod.HEAPF32.buffer);
+    heap.set(encoded, ptr);
+    heap[ptr + encoded.length] = 0;
+    return ptr;
+}
+
+function readTimeline() {
+    // phone runs of the utterance just built, four int32 each (see tts_get_timeline)
+    if (typeof mod._tts_get_timeline !== 'function') return null;
+    const n = mod._tts_get_timeline_len();
+    return n > 0 ? new Int32Array(mod.HEAPF32.buffer, mod._tts_get_timeline(), n * 4).slice() : null;
+}
+
+function setVoice(d) {
+    // whisper, voice preset and render rate travel with every request
+    mod._tts_set_whisper(d.whisper ? 1 : 0);
+    if (typeof mod._tts_set_voice === 'function') mod._tts_set_voice(d.voice | 0);
+    if (d.rate && typeof mod._tts_set_sample_rate === 'function') mod._tts_set_sample_rate(d.rate);
+}
+
+function stream(d) {
+    // render one utterance into the ring, waiting whenever it is full. a seek
+    // continues the last utterance from d.pos instead, in a new ring run
+    if (Atomics.load(hdr, RING_CANCEL) !== d.gen) return;
+    const cap  = data.length;
+    const mask = cap - 1;
+
+    let total = 0, from = 0, tl = null;
+    if (d.type === 'seek') {
+        from = cur ? mod._tts_stream_seek(d.pos) : -1;
+        if (from >= 0) total = cur.total;
+        else from = 0;
+    } else {
+        setVoice(d);
+        const sp = allocString(d.txt);
+        total = sp ? mod._tts_stream_begin(sp) : 0;
+        if (sp) mod._free(sp);
+        tl  = total > 0 ? readTimeline() : null;
+        cur = total > 0 ? { total: total, all: new Float32Array(total), high: 0 } : null;
+    }
+
+    // reset the ring, publishing the generation last
+    Atomics.store(hdr, RING_WRITE, 0);
+    Atomics.store(hdr, RING_READ, 0);
+    Atomics.store(hdr, RING_DONE, 0);
+    Atomics.store(hdr, RING_TOTAL, total - from);
+    Atomics.store(hdr, RING_UNDERRUNS, 0);
+    Atomics.store(hdr, RING_MIN_FILL, cap);
+    Atomics.store(hdr, RING_GEN, d.gen);
+    postMessage({ type: 'started', gen: d.gen, total: total, from: from, seek: d.type === 'seek', tl: tl });
+
+    // the whole utterance is kept for replay and export on the main thread,
+    // complete once a run reaches the end with no gap before it
+    const joined = cur && from <= cur.high;
+    let w = 0;
+    let cancelled = false;
+    while (from + w < total) {
+        if (Atomics.load(hdr, RING_CANCEL) !== d.gen) { cancelled = true; break; }
+        const r = Atomics.load(hdr, RING_READ);
+        if (cap - (w - r) < BLOCK) {
+            Atomics.wait(hdr, RING_READ, r, 20);
+            continue;
+        }
+        const got = mod._tts_stream_read(blockPtr, BLOCK);
+        if (got <= 0) break;
+        const src   = new Float32Array(mod.HEAPF32.buffer, blockPtr, got);
+        const at    = w & mask;
+        const first = Math.min(got, cap - at);
+        data.set(src.subarray(0, first), at);
+        if (first < got) data.set(src.subarray(first), 0);
+        if (cur.all) cur.all.set(src, from + w);
+        w += got;
+        Atomics.store(hdr, RING_WRITE, w);
+    }
+    Atomics.store(hdr, RING_DONE, 1);
+
+    if (joined) cur.high = Math.max(cur.high, from + w);
+    if (!cancelled && joined && cur.all) {
+        postMessage({ type: 'done', gen: d.gen, buf: cur.all, len: cur.high }, [cur.all.buffer]);
+        cur.all = null;
+    }
+}
+
+function render(d) {
+    // synthesise one piece of text and hand the samples back. incremental
+    // requests go through the engine's sentence index and only render the
+    // sentences that changed since the last of them
+    setVoice(d);
+    const inc = d.incremental && typeof mod._tts_speak_incremental === 'function';
+    const sp  = allocString(d.txt);
+    const got = sp ? (inc ? mod._tts_speak_incremental(sp) : mod._tts_speak(sp)) : 0;
+    if (sp) mod._free(sp);
+    const buf = got > 0 ? new Float32Array(mod.HEAPF32.buffer, mod._tts_get_buf(), got).slice()
+                        : new Float32Array(0);
+    const tl  = got > 0 ? readTimeline() : null;
+    postMessage({ type: 'rendered', id: d.id, buf: buf, tl: tl }, [buf.buffer]);
+}
+
+onmessage = (e) => {
+    const d = e.data;
+    if (d.type === 'init') {
+        // attach the shared ring, only the streaming worker gets one
+        hdr  = new Int32Array(d.sab, 0, 8);
+        data = new Float32Array(d.sab, RING_HEADER, d.capacity);
+    } else if (d.type === 'speak' || d.type === 'seek') {
+        // utterances run one after another, a newer one cancels through RING_CANCEL
+        queue = queue.then(() => stream(d));
+    } else if (d.type === 'render') {
+        queue = queue.then(() => render(d));
+    }
+};
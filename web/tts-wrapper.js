@@ -1,19 +1,231 @@
 // tts wrapper core
+
+// shared ring header slots (int32), see tts-worker.js
+var TTS_RING = {
+    WRITE: 0, READ: 1, GEN: 2, DONE: 3, TOTAL: 4, UNDERRUNS: 5, MIN_FILL: 6, CANCEL: 7,
+    HEADER: 32   // bytes before the sample data
+};
+
+// compressed storage codecs, see tts_codec.h
+var TTS_CODEC = { F32: 0, ULAW: 1, ADPCM: 2 };
+
 var TTSWrapper = {
     Module:       null,
     sampleRate:   16000,
+    renderRate:   0,    // 0 renders at the audio device's rate, or a fixed rate such as 16000
     _ctx:         null,
     _node:        null,
-    _rawBuf:      null,
+    _rawPtr:      0,    // last utterance, owned by the wrapper in the wasm heap
+    _rawLen:      0,
+    _rawCopy:     null, // js copy when the module cannot hand out its buffer
+    _dspModule:   null, // compiled tts-dsp.wasm for the worklet
+    _worker:      null, // synthesis worker for streaming playback
+    _ring:        null, // SharedArrayBuffer between worker and worklet
+    _ringHdr:     null,
+    _ringCap:     1 << 15,
+    _streamReady: false,
+    _streamLen:   0,
+    _gen:         0,    // current streamed utterance
+    _onStarted:   null,
+    _whisper:     false,
+    _voice:       0,    // engine voice preset, see setVoicePreset
+    _job:         0,    // main-thread synthesis job in progress
+    _yieldChan:   null,
+    _yieldQueue:  [],
+    onProgress:   null, // optional callback for speak() progress
+    onPhone:      null, // optional callback, { start, code, kind, amp } of the phone now playing
+    _timeline:    null, // phone runs of the current utterance, see _readTimeline
+    poolSize:     Math.max(1, Math.min(8, ((typeof navigator !== 'undefined' && navigator.hardwareConcurrency) || 2) - 1)), // read once, on first use
+    _pool:        null, // workers rendering sentences in parallel
+    _poolTasks:   [],   // sentences waiting for a free worker, in text order
+    _poolRun:     0,    // current parallel utterance, older results are dropped
+    _poolResolve: null,
     _playing:     false,
+    incremental:  true, // speak() of an edited text renders only the sentences that changed
+    _lastParts:   null, // sentences of the last speak(), to tell an edit
+    _incId:       0,    // current incremental render in the streaming worker
+    _incResolve:  null,
+    _seekMode:    null, // how seek() reaches the playing utterance: 'buffer', 'stream' or null
     _destination: null, // external gain node
+    // engine builds, best first. load() starts the first one the browser
+    // runs; workers only render on one thread, they take the best build without threads
+    moduleVariants: [
+        { file: 'tts-simd-mt.js', simd: true,  threads: true },
+        { file: 'tts-simd.js',    simd: true,  threads: false },
+        { file: 'tts.js',         simd: false, threads: false }
+    ],
+    _moduleFile:  'tts.js',
+    _workerFile:  'tts.js',
+    _dspFile:     'tts-dsp.wasm',
+
+    features: function() {
+        // wasm simd128 and threads (shared memory, usable once cross-origin isolated),
+        // each tested by validating a tiny module that needs it
+        const ok = (bytes) => {
+            try { return WebAssembly.validate(new Uint8Array(bytes)); } catch (e) { return false; }
+        };
+        const simd = ok([0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0, 1, 123, 3, 2, 1, 0,
+                         10, 10, 1, 8, 0, 65, 0, 253, 15, 253, 98, 11]);
+        const threads = typeof SharedArrayBuffer !== 'undefined' && !!self.crossOriginIsolated &&
+            ok([0, 97, 115, 109, 1, 0, 0, 0, 1, 4, 1, 96, 0, 0, 3, 2, 1, 0, 5, 4, 1, 3, 1, 1,
+                10, 11, 1, 9, 0, 65, 0, 254, 16, 2, 0, 26, 11]);
+        return { simd: simd, threads: threads };
+    },
+
+    _loadScript: function(src) {
+        return new Promise((resolve, reject) => {
+            const el = document.createElement('script');
+            el.src = src;
+            el.onload = resolve;
+            el.onerror = () => { el.remove(); reject(new Error('cannot load ' + src)); };
+            document.head.appendChild(el);
+        });
+    },
+
+    load: async function() {
+        // load and init the best engine build for this browser, falling back
+        // to the next when one is missing or fails to start (tts.js is scalar)
+        const f = this.features();
+        const runs = this.moduleVariants.filter((v) => (!v.simd || f.simd) && (!v.threads || f.threads));
+        let err = null;
+        for (const v of runs) {
+            try {
+                await this._loadScript(v.file);
+                this._moduleFile = v.file;
+                this._workerFile = (runs.find((w) => !w.threads) || v).file;
+                this._dspFile    = f.simd ? 'tts-dsp-simd.wasm' : 'tts-dsp.wasm';
+                await this.init(TTSModule);
+                return;
+            } catch (e) {
+                err = e;
+            }
+        }
+        throw err || new Error('no TTS module variant can run here');
+    },
+
+    getKernelInfo: function() {
+        // builds in use and the engine's kernel path (tts_get_kernel_info)
+        const mod = this.Module;
+        let kernels = '';
+        if (mod && typeof mod._tts_get_kernel_info === 'function') {
+            const heap = new Uint8Array(mod.HEAPF32.buffer);
+            const ptr  = mod._tts_get_kernel_info();
+            let end = ptr;
+            while (heap[end]) end++;
+            kernels = new TextDecoder().decode(heap.subarray(ptr, end));
+        }
+        return { module: this._moduleFile, worker: this._workerFile, dsp: this._dspFile, kernels: kernels };
+    },
 
     init: async function(TTSModuleFactory) {
         // initialize module and get sample rate
         const mod = await TTSModuleFactory();
         this.Module     = mod;
         this.sampleRate = mod._tts_sample_rate();
-        console.log('TTS ready, sample rate:', this.sampleRate);
+        this._initStream();
+        console.log('TTS ready, sample rate:', this.sampleRate, 'kernels:', this.getKernelInfo().kernels || 'unknown');
+    },
+
+    _initStream: function() {
+        // synthesis worker feeding the worklet through a shared ring,
+        // needs cross-origin isolation for SharedArrayBuffer
+        if (typeof SharedArrayBuffer === 'undefined' || !self.crossOriginIsolated) return;
+        try {
+            this._ring    = new SharedArrayBuffer(TTS_RING.HEADER + this._ringCap * 4);
+            this._ringHdr = new Int32Array(this._ring, 0, 8);
+            this._worker  = new Worker(this._workerUrl());
+        } catch (e) {
+            this._ring = this._ringHdr = this._worker = null;
+            return;
+        }
+        this._worker.onmessage = (e) => this._onWorker(e.data);
+        this._worker.postMessage({ type: 'init', sab: this._ring, capacity: this._ringCap });
+    },
+
+    _workerUrl: function() {
+        // synthesis workers load the engine build named in the query
+        return 'tts-worker.js?module=' + encodeURIComponent(this._workerFile);
+    },
+
+    _onWorker: function(d) {
+        // worker status, audio itself travels through the ring
+        if (d.type === 'ready') {
+            this._streamReady = true;
+        } else if (d.type === 'started') {
+            if (d.gen !== this._gen) return;
+            this._streamLen = d.total;
+            if (!d.seek) {
+                this._timeline = d.tl || null;
+                if (this._node) this._node.port.postMessage({ type: 'timeline', gen: d.gen, tl: this._timeline });
+            }
+            if (this._onStarted) { const f = this._onStarted; this._onStarted = null; f(d.total); }
+        } else if (d.type === 'rendered') {
+            if (d.id !== this._incId || !this._incResolve) return;
+            const f = this._incResolve;
+            this._incResolve = null;
+            f(d);
+        } else if (d.type === 'done') {
+            // keep the whole utterance for replay and export
+            if (d.gen !== this._gen) return;
+            this._releaseRaw();
+            this._rawCopy = d.buf.subarray(0, d.len);
+        }
+    },
+
+    getLength: function() {
+        // samples in the current utterance, known once streaming has started
+        const raw = this._rawBuf;
+        return raw ? raw.length : this._streamLen;
+    },
+
+    getTimeline: function() {
+        // phone runs of the current utterance (see _readTimeline), null when unknown
+        return this._timeline;
+    },
+
+    getStreamStats: function() {
+        // ring fill level and underruns of the streaming path, null when it is not in use
+        const h = this._ringHdr;
+        if (!h) return null;
+        const w = Atomics.load(h, TTS_RING.WRITE);
+        return {
+            fill:      w - Atomics.load(h, TTS_RING.READ),
+            minFill:   Atomics.load(h, TTS_RING.MIN_FILL),
+            capacity:  this._ringCap,
+            underruns: Atomics.load(h, TTS_RING.UNDERRUNS),
+            written:   w,
+            total:     Atomics.load(h, TTS_RING.TOTAL)
+        };
+    },
+
+    _readTimeline: function() {
+        // copy the phone runs of the utterance the engine built last, four int32
+        // each: start sample, code, type | flags << 8, peak amplitude (as float32)
+        const mod = this.Module;
+        if (typeof mod._tts_get_timeline !== 'function') return null;
+        const n = mod._tts_get_timeline_len();
+        if (n <= 0) return null;
+        return new Int32Array(mod.HEAPF32.buffer, mod._tts_get_timeline(), n * 4).slice();
+    },
+
+    _joinTimelines: function(tls, bufs) {
+        // one timeline for sentences played back to back: runs move by the samples
+        // before them and only the last sentence keeps its closing run
+        let n = 0;
+        for (let i = 0; i < bufs.length; i++) {
+            if (!tls[i]) return null;
+            n += tls[i].length - (i < bufs.length - 1 ? 4 : 0);
+        }
+        const out = new Int32Array(n);
+        let at = 0, off = 0;
+        for (let i = 0; i < bufs.length; i++) {
+            const m = tls[i].length - (i < bufs.length - 1 ? 4 : 0);
+            out.set(tls[i].subarray(0, m), at);
+            for (let k = at; k < at + m; k += 4) out[k] += off;
+            at  += m;
+            off += bufs[i].length;
+        }
+        return out;
     },
 
     _allocString: function(str) {
@@ -34,24 +246,438 @@ var TTSWrapper = {
             if (this._ctx.state === 'suspended') await this._ctx.resume();
             return;
         }
-        this._ctx = new AudioContext({ sampleRate: this.sampleRate });
+        // render at the device rate so the browser does not resample behind us;
+        // builds without tts_set_sample_rate stay at their own rate
+        const mod = this.Module;
+        if (typeof mod._tts_set_sample_rate === 'function') {
+            this._ctx = this.renderRate ? new AudioContext({ sampleRate: this.renderRate }) : new AudioContext();
+            this.sampleRate = mod._tts_set_sample_rate(this._ctx.sampleRate);
+            if (this.sampleRate !== this._ctx.sampleRate) {
+                this._ctx.close();
+                this._ctx = new AudioContext({ sampleRate: this.sampleRate });
+            }
+        } else {
+            this._ctx = new AudioContext({ sampleRate: this.sampleRate });
+        }
         await this._ctx.audioWorklet.addModule('tts-processor.js');
+
+        // time-scale engine for the worklet, playback falls back to plain resampling without it
+        for (const file of this._dspFile === 'tts-dsp.wasm' ? ['tts-dsp.wasm'] : [this._dspFile, 'tts-dsp.wasm']) {
+            try {
+                const resp = await fetch(file);
+                if (resp.ok) this._dspModule = await WebAssembly.compile(await resp.arrayBuffer());
+            } catch (e) {
+                this._dspModule = null;
+            }
+            if (this._dspModule) { this._dspFile = file; break; }
+        }
+    },
+
+    get _rawBuf() {
+        // view of the last utterance, made per use since heap growth detaches views
+        if (this._rawPtr) return new Float32Array(this.Module.HEAPF32.buffer, this._rawPtr, this._rawLen);
+        return this._rawCopy;
+    },
+
+    _adoptOutput: function(got) {
+        // take the rendered buffer over from the engine instead of copying it out
+        const mod = this.Module;
+        this._releaseRaw();
+        if (got <= 0) return null;
+        if (typeof mod._tts_detach_buf !== 'function') {
+            this._rawCopy = this._readOutput(got);
+            return this._rawCopy;
+        }
+        return this._adoptPtr(mod._tts_detach_buf(), got);
+    },
+
+    _adoptPtr: function(ptr, len) {
+        // own a heap buffer released later with tts_release_buf
+        this._releaseRaw();
+        this._rawPtr = ptr;
+        this._rawLen = ptr ? len : 0;
+        return this._rawBuf;
+    },
+
+    _releaseRaw: function() {
+        // free the previous utterance
+        if (this._rawPtr) this.Module._tts_release_buf(this._rawPtr);
+        this._rawPtr  = 0;
+        this._rawLen  = 0;
+        this._rawCopy = null;
+    },
+
+    _yield: function(fn) {
+        // zero-delay hop through the event loop, settimeout would clamp to 4 ms
+        if (!this._yieldChan) {
+            this._yieldChan = new MessageChannel();
+            this._yieldChan.port1.onmessage = () => {
+                const f = this._yieldQueue.shift();
+                if (f) f();
+            };
+        }
+        this._yieldQueue.push(fn);
+        this._yieldChan.port2.postMessage(0);
+    },
+
+    _jobProgress: function(id) {
+        // read the five int32 progress fields of a job
+        const mod = this.Module;
+        const p   = new Int32Array(mod.HEAPF32.buffer, mod._tts_job_progress(id), 5);
+        return {
+            state:        p[0],
+            framesDone:   p[1],
+            framesTotal:  p[2],
+            samplesDone:  p[3],
+            samplesTotal: p[4]
+        };
+    },
+
+    synthesizeAsync: function(txt, onProgress) {
+        // render in slices of at most ~8 ms between other main-thread work.
+        // resolves with the samples (owned by the wrapper, like _rawBuf) or null if cancelled
+        const mod = this.Module;
+        if (typeof mod._tts_job_start !== 'function') return Promise.resolve(this._synthesize(txt));
+        this.cancel();
+        this._releaseRaw();
+        const sp = this._allocString(txt);
+        if (!sp) return Promise.resolve(null);
+        const id = mod._tts_job_start(sp);
+        mod._free(sp);
+        this._timeline = id ? this._readTimeline() : null;
+        if (!id) return Promise.resolve(null);
+        this._job = id;
+
+        return new Promise((resolve) => {
+            const slice = () => {
+                // cancel() already freed the job
+                if (this._job !== id) { resolve(null); return; }
+                const t0 = performance.now();
+                let st;
+                do {
+                    st = mod._tts_job_step(id, 2048);
+                } while (st === 1 && performance.now() - t0 < 8);
+                if (onProgress) onProgress(this._jobProgress(id));
+                if (st === 1) { this._yield(slice); return; }
+
+                this._job = 0;
+                let raw = null;
+                if (st === 2) {
+                    const lenPtr = mod._malloc(4);
+                    const ptr    = lenPtr ? mod._tts_job_take(id, lenPtr) : 0;
+                    const len    = ptr ? new Int32Array(mod.HEAPF32.buffer, lenPtr, 1)[0] : 0;
+                    if (lenPtr) mod._free(lenPtr);
+                    if (ptr) raw = this._adoptPtr(ptr, len);
+                }
+                mod._tts_job_free(id);
+                resolve(raw);
+            };
+            this._yield(slice);
+        });
+    },
+
+    cancel: function() {
+        // abandon the synthesis in progress, a job's memory is released at once
+        this.cancelPool();
+        if (this._incResolve) { const f = this._incResolve; this._incResolve = null; f(null); }
+        if (!this._job) return;
+        this.Module._tts_job_cancel(this._job);
+        this.Module._tts_job_free(this._job);
+        this._job = 0;
+    },
+
+    splitSentences: function(txt) {
+        // cut after . ! ? or ... (and closing quotes or brackets) followed by
+        // whitespace, so 3.14 stays whole. pieces keep their punctuation and the
+        // whitespace after it, they join back to txt and render the same pauses
+        const parts = [];
+        const n = txt.length;
+        let start = 0;
+        for (let i = 0; i < n; i++) {
+            if ('.!?\u2026'.indexOf(txt[i]) < 0) continue;
+            let j = i + 1;
+            while (j < n && '.!?\u2026'.indexOf(txt[j]) >= 0) j++;
+            while (j < n && '"\')]\u201d\u2019'.indexOf(txt[j]) >= 0) j++;
+            if (j < n && !/\s/.test(txt[j])) { i = j - 1; continue; }
+            while (j < n && /\s/.test(txt[j])) j++;
+            parts.push(txt.slice(start, j));
+            start = j;
+            i = j - 1;
+        }
+        if (start < n) {
+            if (parts.length && !txt.slice(start).trim()) parts[parts.length - 1] += txt.slice(start);
+            else parts.push(txt.slice(start));
+        }
+
+        // a long opening sentence delays the first audio, play its first clause
+        // on its own. questions stay whole, their intonation covers the sentence
+        const first = parts[0];
+        if (parts.length > 1 && first.length > 120 && first.indexOf('?') < 0) {
+            const m = /[,;:]\s+/g;
+            m.lastIndex = 40;
+            const r = m.exec(first);
+            if (r && r.index < first.length - 40) parts.splice(0, 1, first.slice(0, m.lastIndex), first.slice(m.lastIndex));
+        }
+        return parts;
+    },
+
+    _ensurePool: function() {
+        // start poolSize render workers once, each loads its own engine instance
+        if (this._pool) return this._pool;
+        if (typeof Worker === 'undefined') return null;
+        const pool = [];
+        try {
+            for (let i = 0; i < this.poolSize; i++) {
+                const slot = { worker: new Worker(this._workerUrl()), task: null };
+                slot.worker.onmessage = (e) => {
+                    if (e.data.type !== 'rendered') return;
+                    const task = slot.task;
+                    slot.task = null;
+                    if (task) task.done(e.data.buf, e.data.tl);
+                    this._poolDispatch();
+                };
+                pool.push(slot);
+            }
+        } catch (e) {
+            pool.forEach((slot) => slot.worker.terminate());
+            return null;
+        }
+        this._pool = pool;
+        return pool;
+    },
+
+    _poolDispatch: function() {
+        // hand waiting sentences to idle workers, first in text order first
+        for (const slot of this._pool) {
+            if (slot.task || !this._poolTasks.length) continue;
+            slot.task = this._poolTasks.shift();
+            slot.worker.postMessage({ type: 'render', id: slot.task.id, txt: slot.task.txt, whisper: this._whisper, voice: this._voice, rate: this.sampleRate });
+        }
+    },
+
+    _runPool: function(parts, onChunk, tls) {
+        // render parts across the pool. onChunk(i, buf, tl) sees them in order as soon
+        // as every earlier one is there; resolves with all of them, null if cancelled.
+        // tls, when given, collects the phone runs of each part
+        this.cancelPool();
+        const run = this._poolRun;
+        const out = new Array(parts.length);
+        tls = tls || [];
+        let next = 0;
+        return new Promise((resolve) => {
+            this._poolResolve = resolve;
+            parts.forEach((txt, i) => {
+                this._poolTasks.push({ id: i, txt: txt, done: (buf, tl) => {
+                    if (run !== this._poolRun) return;
+                    out[i] = buf;
+                    tls[i] = tl || null;
+                    while (next < parts.length && out[next]) {
+                        if (onChunk) onChunk(next, out[next], tls[next]);
+                        next++;
+                    }
+                    if (next === parts.length) { this._poolResolve = null; resolve(out); }
+                } });
+            });
+            this._poolDispatch();
+        });
+    },
+
+    cancelPool: function() {
+        // drop the parallel utterance, sentences already in a worker finish unseen
+        this._poolRun++;
+        this._poolTasks = [];
+        if (this._poolResolve) { const f = this._poolResolve; this._poolResolve = null; f(null); }
+    },
+
+    synthesizeParallel: function(txt, onChunk) {
+        // split txt into sentences and render them on the worker pool.
+        // resolves with the joined samples (also kept like _rawBuf) or null if cancelled
+        return this._synthesizeParts(this.splitSentences(txt), onChunk);
+    },
+
+    _synthesizeParts: async function(parts, onChunk) {
+        if (!parts.length || !this._ensurePool()) return null;
+        this.cancel();
+        this._releaseRaw();
+        this._timeline = null;
+        const tls  = [];
+        const bufs = await this._runPool(parts, onChunk, tls);
+        if (!bufs) return null;
+        let len = 0;
+        for (const b of bufs) len += b.length;
+        const all = new Float32Array(len);
+        len = 0;
+        for (const b of bufs) { all.set(b, len); len += b.length; }
+        this._rawCopy  = all;
+        this._timeline = this._joinTimelines(tls, bufs);
+        return all;
     },
 
     _synthesize: function(txt) {
-        // call wasm synth and return float32 buffer copy
+        // call wasm synth, the result stays in the wasm heap
         const mod = this.Module;
         const sp  = this._allocString(txt);
         if (!sp) return null;
         const got = mod._tts_speak(sp);
         mod._free(sp);
+        this._timeline = got > 0 ? this._readTimeline() : null;
+        return this._adoptOutput(got);
+    },
+
+    _readOutput: function(got) {
+        // copy rendered samples out of the wasm heap
         if (got <= 0) return null;
+        const mod = this.Module;
         const ptr = mod._tts_get_buf();
         return new Float32Array(mod.HEAPF32.buffer, ptr, got).slice();
     },
 
-    _startPlayback: function(raw, pitchHz, speed, onEnd) {
-        // start playback using audioworklet node
+    synthesizeBatch: function(texts) {
+        // synthesize many texts in one call, returns one Float32Array view per text
+        const mod = this.Module;
+        const n   = texts.length;
+        if (!n) return [];
+        const ptrs = [];
+        for (let i = 0; i < n; i++) {
+            const sp = this._allocString(texts[i]);
+            if (!sp) { ptrs.forEach((p) => mod._free(p)); return null; }
+            ptrs.push(sp);
+        }
+        const arr = mod._malloc(n * 4);
+        if (!arr) { ptrs.forEach((p) => mod._free(p)); return null; }
+        new Uint32Array(mod.HEAPF32.buffer, arr, n).set(ptrs);
+        const total = mod._tts_speak_batch(arr, n, 1);
+        mod._free(arr);
+        ptrs.forEach((p) => mod._free(p));
+        if (total <= 0) return null;
+
+        // one copy of the whole region, items are views into it
+        const all  = this._readOutput(total);
+        const offs = new Int32Array(mod.HEAPF32.buffer, mod._tts_get_batch_offsets(), n + 1);
+        const out  = [];
+        for (let i = 0; i < n; i++) out.push(all.subarray(offs[i], offs[i + 1]));
+        return out;
+    },
+
+    compress: function(samples, codec) {
+        // pack samples for keeping around, adpcm (4 bit) unless codec says ulaw (8 bit).
+        // returns { codec, length, data } for decompress(), null if the module cannot
+        const mod = this.Module;
+        if (!samples || !samples.length || typeof mod._tts_encode !== 'function') return null;
+        codec = codec || TTS_CODEC.ADPCM;
+        const n    = samples.length;
+        const size = mod._tts_encoded_size(codec, n);
+        // samples already in the heap (the wrapper's own buffer) are read in place
+        const inHeap = samples.buffer === mod.HEAPF32.buffer;
+        const inPtr  = inHeap ? samples.byteOffset : mod._malloc(n * 4);
+        if (!inPtr) return null;
+        if (!inHeap) new Float32Array(mod.HEAPF32.buffer, inPtr, n).set(samples);
+        const outPtr = mod._malloc(size);
+        const got    = outPtr ? mod._tts_encode(codec, inPtr, n, outPtr) : 0;
+        const data   = got > 0 ? new Uint8Array(mod.HEAPF32.buffer, outPtr, got).slice() : null;
+        if (outPtr) mod._free(outPtr);
+        if (!inHeap) mod._free(inPtr);
+        return data ? { codec: codec, length: n, data: data } : null;
+    },
+
+    decompress: function(packed, first, count) {
+        // samples [first, first + count) of a compress() result, all of them by default
+        const mod = this.Module;
+        first = first || 0;
+        if (count === undefined) count = packed.length - first;
+        count = Math.min(count, packed.length - first);
+        if (count <= 0) return new Float32Array(0);
+        const inPtr  = mod._malloc(packed.data.length);
+        const outPtr = inPtr ? mod._malloc(count * 4) : 0;
+        let out = null;
+        if (outPtr) {
+            new Uint8Array(mod.HEAPF32.buffer, inPtr, packed.data.length).set(packed.data);
+            const got = mod._tts_decode(packed.codec, inPtr, packed.length, first, count, outPtr);
+            out = new Float32Array(mod.HEAPF32.buffer, outPtr, got).slice();
+        }
+        if (outPtr) mod._free(outPtr);
+        if (inPtr) mod._free(inPtr);
+        return out;
+    },
+
+    toInt16: function(samples, dither) {
+        // float samples to an Int16Array, converted in the engine when it can
+        const mod = this.Module;
+        const n   = samples.length;
+        if (mod && typeof mod._tts_convert === 'function' && n) {
+            const inHeap = samples.buffer === mod.HEAPF32.buffer;
+            const inPtr  = inHeap ? samples.byteOffset : mod._malloc(n * 4);
+            const outPtr = inPtr ? mod._malloc(n * 2) : 0;
+            let out = null;
+            if (outPtr) {
+                if (!inHeap) new Float32Array(mod.HEAPF32.buffer, inPtr, n).set(samples);
+                const got = mod._tts_convert(inPtr, n, 1, dither ? 1 : 0, outPtr);
+                out = new Int16Array(mod.HEAPF32.buffer, outPtr, got).slice();
+            }
+            if (outPtr) mod._free(outPtr);
+            if (inPtr && !inHeap) mod._free(inPtr);
+            if (out) return out;
+        }
+        const out = new Int16Array(n);
+        for (let i = 0; i < n; i++) {
+            const v = Math.max(-1, Math.min(1, samples[i])) * 32767;
+            out[i] = v + (v >= 0 ? 0.5 : -0.5);
+        }
+        return out;
+    },
+
+    replay: async function(packed, pitchHz, speed, onEnd) {
+        // play a compress() result, it becomes the current utterance for loop and export
+        await this._ensureCtx();
+        const raw = this.decompress(packed);
+        if (!raw || !raw.length) return;
+        this.cancel();
+        this._releaseRaw();
+        this._rawCopy  = raw;
+        this._timeline = packed.timeline || null;
+        this._startPlayback(raw, pitchHz, speed, onEnd);
+    },
+
+    compile: function(txt) {
+        // run the text front end once and return the frame sequence as an ArrayBuffer
+        const mod = this.Module;
+        const sp  = this._allocString(txt);
+        if (!sp) return null;
+        const len = mod._tts_compile(sp);
+        mod._free(sp);
+        if (len <= 0) return null;
+        const ptr = mod._tts_get_compiled();
+        return new Uint8Array(mod.HEAPF32.buffer, ptr, len).slice().buffer;
+    },
+
+    loadCompiled: function(blob) {
+        // place a compiled blob in the wasm heap once so it can be rendered many times
+        const mod   = this.Module;
+        const bytes = new Uint8Array(blob);
+        const ptr   = mod._malloc(bytes.length);
+        if (!ptr) return null;
+        new Uint8Array(mod.HEAPF32.buffer).set(bytes, ptr);
+        return { ptr: ptr, len: bytes.length };
+    },
+
+    freeCompiled: function(handle) {
+        // release a blob placed by loadCompiled
+        if (handle && handle.ptr) this.Module._free(handle.ptr);
+        if (handle) handle.ptr = 0;
+    },
+
+    speakCompiled: async function(handle, pitchHz, speed, onEnd) {
+        // play a loaded compiled blob without running the text front end
+        await this._ensureCtx();
+        if (!handle || !handle.ptr) return;
+        const raw = this._adoptOutput(this.Module._tts_render_compiled(handle.ptr, handle.len));
+        this._timeline = raw ? this._readTimeline() : null;
+        if (!raw) return;
+        this._startPlayback(raw, pitchHz, speed, onEnd);
+    },
+
+    _newNode: function(onEnd) {
+        // replace the playing worklet node with a fresh one
         if (this._node) {
             this._node.port.postMessage({ type: 'stop' });
             this._node.disconnect();
@@ -59,39 +685,164 @@ var TTSWrapper = {
         }
 
         this._playing = true;
-        const node = new AudioWorkletNode(this._ctx, 'tts-processor');
+        const node = new AudioWorkletNode(this._ctx, 'tts-processor', {
+            processorOptions: { dsp: this._dspModule }
+        });
         this._node = node;
 
         const dest = this._destination || this._ctx.destination;
         node.connect(dest);
 
+        node.port.onmessage = (e) => {
+            if (e.data.type === 'ended') {
+                this._playing = false;
+                if (this._node === node) this._seekMode = null;
+                node.disconnect();
+                if (this._node === node) this._node = null;
+                if (onEnd) onEnd();
+            } else if (e.data.type === 'phone') {
+                if (this._node === node && this.onPhone) this.onPhone(e.data);
+            }
+        };
+        return node;
+    },
+
+    _cancelStream: function() {
+        // stop the worker rendering the streamed utterance, if any
+        if (this._ringHdr) Atomics.store(this._ringHdr, TTS_RING.CANCEL, ++this._gen);
+    },
+
+    _startPlayback: function(raw, pitchHz, speed, onEnd) {
+        // start playback of a rendered buffer using audioworklet node
+        this._cancelStream();
+        const node = this._newNode(onEnd);
+        this._seekMode = 'buffer';
+
+        // the only copy out of the wasm heap, moved to the worklet without another
         const copy = raw.slice();
         node.port.postMessage({
             type:  'load',
             buf:   copy,
+            tl:    this._timeline,
             pitch: pitchHz / 105.0,
             speed: speed
         }, [copy.buffer]);
+    },
 
-        node.port.onmessage = (e) => {
-            if (e.data.type === 'ended') {
-                this._playing = false;
-                node.disconnect();
-                if (this._node === node) this._node = null;
-                if (onEnd) onEnd();
+    _speakStream: function(txt, pitchHz, speed, onEnd) {
+        // play from the ring while the worker is still rendering,
+        // resolves once the worker knows the utterance length
+        const gen = ++this._gen;
+        Atomics.store(this._ringHdr, TTS_RING.CANCEL, gen);
+        if (this._onStarted) this._onStarted(0);
+        this._releaseRaw();
+        this._streamLen = 0;
+        this._timeline  = null;
+        const started = new Promise((resolve) => { this._onStarted = resolve; });
+
+        this._worker.postMessage({ type: 'speak', txt: txt, gen: gen, whisper: this._whisper, voice: this._voice, rate: this.sampleRate });
+        const node = this._newNode(onEnd);
+        this._seekMode = 'stream';
+        node.port.postMessage({
+            type:     'ring',
+            sab:      this._ring,
+            capacity: this._ringCap,
+            gen:      gen,
+            pitch:    pitchHz / 105.0,
+            speed:    speed
+        });
+        return started;
+    },
+
+    _isEdit: function(txt) {
+        // whether txt shares a sentence with the last speak(), which it replaces
+        const parts = this.splitSentences(txt).map((p) => p.trim()).filter((p) => p);
+        const last  = this._lastParts;
+        this._lastParts = new Set(parts);
+        return !!last && parts.some((p) => last.has(p));
+    },
+
+    _speakIncremental: async function(txt, pitchHz, speed, onEnd) {
+        // render in the streaming worker against the engine's sentence index,
+        // sentences unchanged since its last such render are copied rather
+        // than rendered. playback starts once the whole text is there
+        this._cancelStream();
+        this.cancel();
+        if (this._onStarted) { const f = this._onStarted; this._onStarted = null; f(0); }
+        const id = ++this._incId;
+        const d  = await new Promise((resolve) => {
+            this._incResolve = resolve;
+            this._worker.postMessage({ type: 'render', id: id, txt: txt, incremental: true, whisper: this._whisper, voice: this._voice, rate: this.sampleRate });
+        });
+        if (!d || !d.buf.length) return;
+        this._releaseRaw();
+        this._rawCopy  = d.buf;
+        this._timeline = d.tl || null;
+        this._startPlayback(d.buf, pitchHz, speed, onEnd);
+    },
+
+    _speakParallel: async function(parts, pitchHz, speed, onEnd) {
+        // play sentences as the pool finishes them, the first starts playback
+        this._cancelStream();
+        let node = null;
+        await this._synthesizeParts(parts, (i, buf, tl) => {
+            const last = i === parts.length - 1;
+            if (i === 0) {
+                node = this._newNode(onEnd);
+                this._seekMode = null;   // sentences play as separate buffers
+                node.port.postMessage({
+                    type:  'load',
+                    buf:   buf,
+                    tl:    tl,
+                    more:  !last,
+                    pitch: pitchHz / 105.0,
+                    speed: speed
+                });
+            } else if (node === this._node) {
+                node.port.postMessage({ type: 'append', buf: buf, tl: tl, last: last });
             }
-        };
+        });
     },
 
     speak: async function(txt, pitchHz, speed, onEnd) {
-        // ensure context then synthesize and play
+        // ensure context then synthesize and play, streamed when the worker is up,
+        // sentence-parallel on the worker pool otherwise. an edit of the last
+        // text goes through the worker's sentence index instead of streaming
         await this._ensureCtx();
-        const raw = this._synthesize(txt);
+        const edit = this.incremental && this._isEdit(txt);
+        if (this._streamReady && this._dspModule) {
+            if (edit) await this._speakIncremental(txt, pitchHz, speed, onEnd);
+            else await this._speakStream(txt, pitchHz, speed, onEnd);
+            return;
+        }
+        const parts = this.poolSize > 1 && typeof Worker !== 'undefined' ? this.splitSentences(txt) : [];
+        if (parts.length > 1) {
+            await this._speakParallel(parts, pitchHz, speed, onEnd);
+            return;
+        }
+        const raw = await this.synthesizeAsync(txt, this.onProgress);
         if (!raw) return;
-        this._rawBuf = raw;
         this._startPlayback(raw, pitchHz, speed, onEnd);
     },
 
+    seek: function(sample) {
+        // continue the playing utterance from input sample, without rendering
+        // anything before it again. false when the playback cannot seek
+        const node = this._node;
+        if (!node || !this._seekMode) return false;
+        sample = Math.max(0, Math.floor(sample));
+        if (this._seekMode === 'stream') {
+            // the worker jumps its stream there and refills the ring
+            const gen = ++this._gen;
+            Atomics.store(this._ringHdr, TTS_RING.CANCEL, gen);
+            this._worker.postMessage({ type: 'seek', gen: gen, pos: sample });
+            node.port.postMessage({ type: 'seek', gen: gen, pos: sample });
+        } else {
+            node.port.postMessage({ type: 'seek', pos: sample });
+        }
+        return true;
+    },
+
     setParams: function(pitchHz, speed) {
         // send realtime params to worklet
         if (this._node) {
@@ -106,14 +857,26 @@ var TTSWrapper = {
     // calls the exported C function tts_set_whisper(int).
     // must be called BEFORE speak() — the effect is baked during synthesis.
     setWhisper: function(enable) {
+        this._whisper = !!enable;
         if (!this.Module) return;
         if (typeof this.Module._tts_set_whisper === 'function') {
             this.Module._tts_set_whisper(enable ? 1 : 0);
         }
     },
 
+    // engine voice preset (tts_set_voice): 0 default, 1 deep, 2 bright, 3 child.
+    // like whisper it applies from the next speak()
+    setVoicePreset: function(preset) {
+        this._voice = preset | 0;
+        if (this.Module && typeof this.Module._tts_set_voice === 'function') {
+            this._voice = this.Module._tts_set_voice(this._voice);
+        }
+    },
+
     stop: function() {
-        // stop and disconnect worklet
+        // stop synthesis and disconnect worklet
+        this.cancel();
+        this._cancelStream();
         if (this._node) {
             this._node.port.postMessage({ type: 'stop' });
             this._node.disconnect();
@@ -123,9 +886,23 @@ var TTSWrapper = {
     },
 
     renderWav: function(pitchHz, speed) {
-        // render resampled wav from raw buffer
+        // render wav from raw buffer with independent pitch and speed.
+        // returns a view into the wasm heap, valid until the next engine call
         const raw = this._rawBuf;
         if (!raw) return null;
+        const mod = this.Module;
+        if (typeof mod._tts_stretch === 'function') {
+            // streamed utterances arrive as a js copy and go into the heap once
+            let ptr = this._rawPtr;
+            if (!ptr && (ptr = mod._malloc(raw.length * 4))) {
+                new Float32Array(mod.HEAPF32.buffer, ptr, raw.length).set(raw);
+            }
+            const got = ptr ? mod._tts_stretch(ptr, raw.length, speed, pitchHz / 105.0) : 0;
+            if (ptr && ptr !== this._rawPtr) mod._free(ptr);
+            if (got > 0) return new Float32Array(mod.HEAPF32.buffer, mod._tts_get_stretch_buf(), got);
+        }
+
+        // fallback: linear resampling, pitch also changes tempo
         const step   = speed * (pitchHz / 105.0);
         const outLen = Math.round(raw.length / step);
         const out    = new Float32Array(outLen);
@@ -137,5 +914,54 @@ var TTSWrapper = {
             out[i]    = raw[lo] * (1 - t) + raw[hi] * t;
         }
         return out;
+    },
+
+    exportWav: function(pitchHz, speed, float32) {
+        // the current utterance, stretched, as a wav Blob (16 bit dithered, or float).
+        // the engine hands the data out a chunk at a time and the chunks are folded
+        // into the Blob as they come, so export memory does not grow with duration
+        const raw = this._rawBuf;
+        if (!raw) return null;
+        const mod = this.Module;
+        const fmt = float32 ? 0 : 1;
+        if (typeof mod._tts_export_begin === 'function') {
+            let ptr = this._rawPtr;
+            if (!ptr && (ptr = mod._malloc(raw.length * 4))) {
+                new Float32Array(mod.HEAPF32.buffer, ptr, raw.length).set(raw);
+            }
+            const chunk = ptr ? mod._malloc(65536) : 0;
+            let blob = null;
+            if (chunk && mod._tts_export_begin(ptr, raw.length, speed, pitchHz / 105.0, fmt, 1)) {
+                let parts = [], held = 0, got;
+                blob = new Blob([]);
+                while ((got = mod._tts_export_read(chunk, 65536)) > 0) {
+                    parts.push(new Uint8Array(mod.HEAPF32.buffer, chunk, got).slice());
+                    if ((held += got) >= (1 << 20)) {
+                        blob = new Blob([blob].concat(parts));
+                        parts = []; held = 0;
+                    }
+                }
+                const hdr = new Uint8Array(mod.HEAPF32.buffer, mod._tts_export_header(), 44).slice();
+                blob = new Blob([hdr, blob].concat(parts), { type: 'audio/wav' });
+            }
+            if (chunk) mod._free(chunk);
+            if (ptr && ptr !== this._rawPtr) mod._free(ptr);
+            if (blob) return blob;
+        }
+
+        // fallback: whole buffer at once
+        const out  = this.renderWav(pitchHz, speed);
+        const pcm  = float32 ? new Float32Array(out) : this.toInt16(out, true);
+        const sr   = this.sampleRate;
+        const hdr  = new DataView(new ArrayBuffer(44));
+        const ws   = (o, str) => { for (let i = 0; i < str.length; i++) hdr.setUint8(o + i, str.charCodeAt(i)); };
+        const size = pcm.byteLength, bytes = pcm.BYTES_PER_ELEMENT;
+        ws(0, 'RIFF'); hdr.setUint32(4, 36 + size, true);
+        ws(8, 'WAVE'); ws(12, 'fmt '); hdr.setUint32(16, 16, true);
+        hdr.setUint16(20, float32 ? 3 : 1, true); hdr.setUint16(22, 1, true);
+        hdr.setUint32(24, sr, true); hdr.setUint32(28, sr * bytes, true);
+        hdr.setUint16(32, bytes, true); hdr.setUint16(34, bytes * 8, true);
+        ws(36, 'data'); hdr.setUint32(40, size, true);
+        return new Blob([hdr.buffer, pcm.buffer], { type: 'audio/wav' });
     }
 };